@@ -18,8 +18,18 @@ namespace reboost {
 /// message size type
 typedef signed char mlength_t;
 
-/// maximum number of buffers per message (default is 8)
-const mlength_t message_max_buffers = (1L << 3);
+/// number of buffers stored without extra allocation (power of two, default is 8)
+#ifndef REBOOST_MESSAGE_INLINE_BUFFERS
+#define REBOOST_MESSAGE_INLINE_BUFFERS 8
+#endif
+
+/// maximum number of buffers per message (power of two below 128, default is 64)
+#ifndef REBOOST_MESSAGE_MAX_BUFFERS
+#define REBOOST_MESSAGE_MAX_BUFFERS 64
+#endif
+
+/// maximum number of buffers per message
+const mlength_t message_max_buffers = REBOOST_MESSAGE_MAX_BUFFERS;
 
 //! A Copy-on-Write Message with Shared Buffers.
 /**
@@ -27,9 +37,10 @@ const mlength_t message_max_buffers = (1L << 3);
  *
  * A message holds a limited (defined by <code>message_max_buffers</code>)
  * number of shared buffers. One can add new buffers and messages in front and
- * at the end of a message. If the no. of buffers exceed
- * <code>message_max_buffers</code>, then the two smallest successive buffers
- * are compacted to one buffer.
+ * at the end of a message. The first <code>REBOOST_MESSAGE_INLINE_BUFFERS</code>
+ * buffers are stored inside the message, beyond that the buffer list grows
+ * on the heap. If the no. of buffers exceed <code>message_max_buffers</code>,
+ * then the two smallest successive buffers are compacted to one buffer.
  *
  * @author Sebastian Mies <mies@reboost.org>
  */
@@ -114,6 +125,37 @@ public:
 		own().push_front(buf);
 	}
 
+	/// Makes room for size (uninitialized) bytes at the front of the message,
+	/// in the headroom of the first buffer if that one is not shared.
+	/// Otherwise a new buffer with the given headroom is added.
+	inline void reserve_front(bsize_t size, bsize_t headroom = 0) {
+		imsg_t& m = own();
+		if (m.length > 0 && m.at(0).grow_front(size)) return;
+		m.push_front(shared_buffer_t::with_headroom(size, headroom));
+	}
+
+	/// Adds a buffer at the front of the message. Its content is copied into
+	/// the headroom of the first buffer if that one is not shared and has
+	/// enough space, so small headers do not add a buffer to the message.
+	inline void prepend(const buffer_t& buf) {
+		imsg_t& m = own();
+		if (m.length > 0 && m.at(0).grow_front(buf.size())) {
+			buf.copy_to(m.at(0), 0);
+			return;
+		}
+		m.push_front(shared_buffer_t(buf));
+	}
+
+	/// Adds a shared buffer at the front of the message, see prepend(buffer_t)
+	inline void prepend(const shared_buffer_t& buf) {
+		imsg_t& m = own();
+		if (m.length > 0 && m.at(0).grow_front(buf.size())) {
+			buf.copy_to(m.at(0), 0);
+			return;
+		}
+		m.push_front(buf);
+	}
+
 	/// Adds a message at the end of the message
 	inline void push_front(const message_t& msg) {
 		own();
@@ -249,36 +291,67 @@ private:
 	class imsg_t {
 	public:
 		volatile message_t* owner;
-		shared_buffer_t buffers[message_max_buffers];
-		mlength_t index, length;
+		shared_buffer_t inline_buffers[REBOOST_MESSAGE_INLINE_BUFFERS];
+		shared_buffer_t* buffers;
+		mlength_t capacity, index, length;
 	public:
 		inline imsg_t() :
+			buffers(inline_buffers), capacity(REBOOST_MESSAGE_INLINE_BUFFERS),
 			index(0), length(0) {
 		}
 		inline imsg_t(const imsg_t& imsg) :
-			index(imsg.index), length(imsg.length) {
-			for (mlength_t i = 0; i < length; i++)
-				at(index + i) = imsg.at(index + i);
+			buffers(inline_buffers), capacity(REBOOST_MESSAGE_INLINE_BUFFERS),
+			index(0), length(0) {
+			reserve(imsg.length);
+			for (mlength_t i = 0; i < imsg.length; i++)
+				buffers[i] = imsg.at(i);
+			length = imsg.length;
+		}
+		inline ~imsg_t() {
+			if (buffers != inline_buffers) delete[] buffers;
 		}
 		inline shared_buffer_t& at(mlength_t idx) {
 			if (idx < 0) idx += length;
-			return buffers[(idx + index) & (message_max_buffers - 1)];
+			return buffers[(idx + index) & (capacity - 1)];
 		}
 		inline const shared_buffer_t& at(mlength_t idx) const {
 			if (idx < 0) idx += length;
-			return buffers[(idx + index) & (message_max_buffers - 1)];
+			return buffers[(idx + index) & (capacity - 1)];
+		}
+
+		/// grows the buffer list to hold at least n buffers
+		inline void reserve(mlength_t n) {
+			if (n <= capacity) return;
+			mlength_t c = capacity;
+			while (c < n) c *= 2;
+			shared_buffer_t* nb = new shared_buffer_t[c];
+			for (mlength_t i = 0; i < length; i++) {
+				nb[i] = at(i);
+				at(i).reset();
+			}
+			if (buffers != inline_buffers) delete[] buffers;
+			buffers = nb;
+			capacity = c;
+			index = 0;
+		}
+
+		/// makes room for one more buffer
+		inline void make_room() {
+			if (length < capacity) return;
+			if (capacity < message_max_buffers) reserve(capacity * 2);
+			else compact();
 		}
 
 		inline void push_back(const shared_buffer_t& buf) {
 			if (buf.size() == 0) return;
-			if (length == message_max_buffers) compact();
+			make_room();
 			at(length) = buf;
 			length++;
 		}
 
 		inline void push_front(const shared_buffer_t& buf) {
 			if (buf.size() == 0) return;
-			if (length == message_max_buffers) compact();
+			make_room();
 			index--;
 			length++;
 			at(0) = buf;
@@ -306,7 +379,7 @@ private:
 
 			// find compacting candidate
 			bsize_t min_size=~0, min_pos=0;
-			for (mlength_t i=0; i<length; i++) {
+			for (mlength_t i=0; i<length-1; i++) {
 				bsize_t c = at(i).size() + at(i+1).size();
 				if (c < min_size || min_size == ~(bsize_t)0 ) {
 					min_size = c;
@@ -320,8 +393,9 @@ private:
 			at(min_pos+1).copy_to( nb, at(min_pos).size() );
 
 			// move buffers and assign new buffer
-			for (mlength_t i=min_pos+1; i<length; i++) at(i) = at(i+1);
+			for (mlength_t i=min_pos+1; i<length-1; i++) at(i) = at(i+1);
 			at(min_pos) = nb;
+			at(length-1).reset();
 
 			length--;
 		}
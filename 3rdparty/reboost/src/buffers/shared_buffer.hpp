@@ -26,6 +26,14 @@ namespace reboost {
  */
 class shared_buffer_t: public buffer_t {
 	typedef shared_buffer_t self;
+public:
+	/// takes back the memory of buffers it handed out (e.g. a buffer pool)
+	class recycler {
+	public:
+		virtual ~recycler() {}
+		virtual void recycle(boctet_t* data) = 0;
+	};
+
 private:
 	static void onexit();
 	static size_t init();
@@ -37,10 +45,18 @@ private:
 			buffer_t(size) {
 			allocated_buffers++;
 		}
+		deleteable_buffer(bsize_t size, boctet_t* data,
+				const boost::shared_ptr<recycler>& owner) :
+			buffer_t(size, data), owner(owner) {
+			allocated_buffers++;
+		}
 		~deleteable_buffer() {
-			if (!is_null()) delete[] data_;
+			if (owner.get() != NULL) owner->recycle(data_);
+			else if (!is_null()) delete[] data_;
 			allocated_buffers--;
 		}
+	private:
+		boost::shared_ptr<recycler> owner;
 	};
 	boost::shared_ptr<deleteable_buffer> parent;
 
@@ -56,6 +72,13 @@ public:
 		buffer_t::operator=(*parent);
 	}
 
+	/// wrap memory of a recycler, which gets it back on the last release
+	inline shared_buffer_t(boctet_t* data, bsize_t size,
+			const boost::shared_ptr<recycler>& owner) :
+		buffer_t(), parent(new deleteable_buffer(size, data, owner)) {
+		buffer_t::operator=(*parent);
+	}
+
 	/// create shared buffer from string
 	inline shared_buffer_t(const char* string) :
 		buffer_t(), parent() {
@@ -99,6 +122,29 @@ public:
 		return (n);
 	}
 
+	/// create a buffer of a specific size with reserved space in front of it,
+	/// see grow_front()
+	static inline self with_headroom(bsize_t size, bsize_t headroom) {
+		self b(size + headroom);
+		b.data_ += headroom;
+		b.size_ = size;
+		return b;
+	}
+
+	/// returns the number of unused bytes in front of this buffer
+	inline bsize_t headroom() const {
+		return parent.get() != NULL ? (bsize_t) (data_ - parent->data()) : 0;
+	}
+
+	/// extends the buffer to the front by n bytes of its headroom; only
+	/// possible if the buffer is not shared (returns false otherwise)
+	inline bool grow_front(bsize_t n) {
+		if (!parent.unique() || headroom() < n) return false;
+		data_ -= n;
+		size_ += n;
+		return true;
+	}
+
 	/// returns the number of references
 	inline size_t use_count() const {
 		return (parent.use_count());
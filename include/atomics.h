@@ -0,0 +1,102 @@
+/** @file
+ * atomics.h
+ *
+ * @brief Minimal atomic integer and pointer type
+ *
+ * (c) 2008-2012 Institut fuer Telematik, KIT, Germany
+ *
+ * We still compile as C++98 and cannot rely on boost.atomic being present
+ * (boost >= 1.46 is required only), so this wraps the GCC __atomic builtins
+ * (GCC >= 4.7, clang >= 3.1). The interface follows std::atomic so that the
+ * class can be replaced by a typedef once we move to C++11.
+ */
+
+#ifndef ATOMICS_H_
+#define ATOMICS_H_
+
+namespace nena
+{
+
+enum memory_order
+{
+	memory_order_relaxed = __ATOMIC_RELAXED,
+	memory_order_acquire = __ATOMIC_ACQUIRE,
+	memory_order_release = __ATOMIC_RELEASE,
+	memory_order_acq_rel = __ATOMIC_ACQ_REL,
+	memory_order_seq_cst = __ATOMIC_SEQ_CST
+};
+
+/**
+ * @brief	Atomic integral or pointer value.
+ *
+ * 			T must be an integral type or a pointer with a size of 1, 2, 4
+ * 			or 8 bytes.
+ */
+template<typename T>
+class atomic
+{
+private:
+	T v;
+
+	// not copyable
+	atomic(const atomic&);
+	atomic& operator=(const atomic&);
+
+public:
+	atomic() : v(T()) {}
+	atomic(T val) : v(val) {}
+
+	inline T load(memory_order mo = memory_order_seq_cst) const
+	{
+		return __atomic_load_n(&v, mo);
+	}
+
+	inline void store(T val, memory_order mo = memory_order_seq_cst)
+	{
+		__atomic_store_n(&v, val, mo);
+	}
+
+	inline T exchange(T val, memory_order mo = memory_order_seq_cst)
+	{
+		return __atomic_exchange_n(&v, val, mo);
+	}
+
+	/**
+	 * @brief	Strong compare and swap. On failure, expected is updated to
+	 * 			the current value.
+	 */
+	inline bool compare_exchange(T& expected, T desired, memory_order mo = memory_order_seq_cst)
+	{
+		return __atomic_compare_exchange_n(&v, &expected, desired, false, mo,
+				mo == memory_order_acq_rel ? memory_order_acquire :
+				(mo == memory_order_release ? memory_order_relaxed : mo));
+	}
+
+	/// integral types only (not scaled for pointers)
+	inline T fetch_add(T val, memory_order mo = memory_order_seq_cst)
+	{
+		return __atomic_fetch_add(&v, val, mo);
+	}
+
+	/// integral types only (not scaled for pointers)
+	inline T fetch_sub(T val, memory_order mo = memory_order_seq_cst)
+	{
+		return __atomic_fetch_sub(&v, val, mo);
+	}
+};
+
+/**
+ * @brief	Hint to the CPU that we are spinning.
+ */
+inline void cpu_relax()
+{
+#if defined(__i386__) || defined(__x86_64__)
+	__asm__ __volatile__ ("pause" ::: "memory");
+#else
+	__asm__ __volatile__ ("" ::: "memory");
+#endif
+}
+
+}
+
+#endif /* ATOMICS_H_ */
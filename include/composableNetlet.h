@@ -31,6 +31,7 @@ class IBuildingBlock : public IMessageProcessor {
 protected:
 	CNena *nena;
 	IComposableNetlet * netlet;
+	bool reentrant;		///< see isReentrant()
 
 public:    
 	/**
@@ -42,7 +43,7 @@ public:
 	 * @param id		id of the building block, has to be unique in netlet
 	 */
 	IBuildingBlock(CNena *nena, IMessageScheduler *sched, IComposableNetlet *netlet, const std::string id) :
-		IMessageProcessor(sched), nena(nena), netlet(netlet)
+		IMessageProcessor(sched), nena(nena), netlet(netlet), reentrant(false)
 	{
 		className += "::IBuildingBlock";
 
@@ -53,6 +54,29 @@ public:
 	 * @brief	Destructor
 	 */
 	virtual ~IBuildingBlock() {};
+
+	/**
+	 * @brief	Building blocks of control Netlets carry control traffic
+	 */
+	virtual bool isControlProcessor() const;
+
+	/**
+	 * @brief	Building blocks that keep no state between messages and hold
+	 * 			no locks while sending opt in by calling setReentrant(true)
+	 * 			in their constructor. The node configuration may override
+	 * 			this per block ("reentrant") or per Netlet
+	 * 			("reentrantBuildingBlocks"), see
+	 * 			CLocalRepository::buildingBlockFactory().
+	 */
+	virtual bool isReentrant() const
+	{
+		return reentrant;
+	}
+
+	void setReentrant(bool r)
+	{
+		reentrant = r;
+	}
 };
 
 /**
@@ -187,6 +211,11 @@ public:
 	}
 };
 
+inline bool IBuildingBlock::isControlProcessor() const
+{
+	return netlet != NULL && netlet->isControlProcessor();
+}
+
 #endif /* COMPOSABLENETLET_H_ */
 
 
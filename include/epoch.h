@@ -0,0 +1,88 @@
+/** @file
+ * epoch.h
+ *
+ * @brief Epoch based reclamation for lock-free readers
+ *
+ * (c) 2008-2012 Institut fuer Telematik, KIT, Germany
+ */
+
+#ifndef EPOCH_H_
+#define EPOCH_H_
+
+namespace nena
+{
+
+/**
+ * @brief	Deferred freeing of objects that lock-free readers may still use
+ *
+ * 			Readers put a CEpoch::CGuard around each access. Entering a guard
+ * 			only writes the current epoch into a record of the calling thread,
+ * 			so readers on different cores never write to a shared cache line.
+ *
+ * 			Writers unlink an object with a sequentially consistent store and
+ * 			hand it to retire(). The global epoch advances once every thread
+ * 			inside a guard has seen the current one. An object is freed two
+ * 			epochs after it was retired, when no guard that could have seen it
+ * 			is left. retire() reclaims right away, so the number of pending
+ * 			objects is bounded by what is retired while a reader is still
+ * 			inside a guard. Guards must not block.
+ */
+class CEpoch
+{
+public:
+	typedef void (*deleter_t)(void *);
+
+	/**
+	 * @brief	Read section, may be nested
+	 */
+	class CGuard
+	{
+	private:
+		// not copyable
+		CGuard(const CGuard&);
+		CGuard& operator=(const CGuard&);
+
+	public:
+		CGuard()
+		{
+			enter();
+		}
+
+		~CGuard()
+		{
+			leave();
+		}
+	};
+
+	/**
+	 * @brief	Frees p with del once no reader can hold it anymore
+	 */
+	static void retire(void * p, deleter_t del);
+
+	template<class T>
+	static void retire(T * p)
+	{
+		retire(p, &destroy<T>);
+	}
+
+	/**
+	 * @brief	Advances the epoch if possible and frees what became
+	 * 			unreachable. Called by retire(), writers may call it
+	 * 			periodically to free the last retired objects.
+	 */
+	static void reclaim();
+
+private:
+	template<class T>
+	static void destroy(void * p)
+	{
+		delete static_cast<T *>(p);
+	}
+
+	static void enter();
+	static void leave();
+};
+
+}
+
+#endif /* EPOCH_H_ */
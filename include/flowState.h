@@ -16,8 +16,12 @@
 #include "appConnector.h" // need to remove this dependency (IAppConnector::method_t)
 
 #include <map>
+#include <list>
 #include <iostream>
 
+#include <boost/unordered_map.hpp>
+#include <boost/weak_ptr.hpp>
+
 /** maximum initial number of allowed packets within the stack */
 #define FLOWSTATE_MAXFLOATINGPACKETS	16
 
@@ -166,6 +170,9 @@ public:
 
 	typedef unsigned int FlowId;
 
+	/// identifies a child flow state: remote node name and remote flow ID
+	typedef std::pair<std::string, FlowId> ChildKey;
+
 	typedef enum {
 		s_valid,	///< valid flow
 		s_stale,	///< errorneous flow
@@ -196,7 +203,9 @@ protected:
 	std::string requestUri; // request URI
 	IAppConnector::method_t requestMethod; // request method (incoming requests)
 
-	std::list<boost::shared_ptr<CFlowState> > childFlowStates;	// TODO: use a better data structure
+	boost::unordered_map<ChildKey, boost::shared_ptr<CFlowState> > childFlowStates;	///< remote node/flow ID -> child flow state
+	std::list<boost::shared_ptr<CFlowState> > unkeyedChildFlowStates;	///< children without remote node name or with a key already taken
+	boost::weak_ptr<CFlowState> parentFlowState;	///< set while this is a child flow state
 
 	/* flow control */
 	unsigned int inFloatingPackets; 	///< number of packets currently floating in stack
@@ -214,6 +223,18 @@ protected:
 	/** additional properties */
 	std::map<IMessage::PropertyId, boost::shared_ptr<CMorphableValue> > properties;
 
+private:
+	friend class CNena;
+
+	/**
+	 * @brief	Sets service URI. CNena indexes flow states by it, use
+	 * 			CNena::setFlowStateServiceId() to change it.
+	 */
+	inline void setServiceId(const std::string& serviceId)
+	{
+		this->serviceId = serviceId;
+	}
+
 public:
 	/**
 	 * @brief	NENA internal, do not create one yourself. Use
@@ -330,7 +351,12 @@ public:
 	 */
 	inline void setRemoteFlowId(FlowId remoteFlowId)
 	{
+		if (this->remoteFlowId == remoteFlowId)
+			return;
+
+		ChildKey oldKey(remoteId, this->remoteFlowId);
 		this->remoteFlowId = remoteFlowId;
+		remoteIdsChanged(oldKey);
 	}
 
 	/**
@@ -341,14 +367,6 @@ public:
 		return serviceId;
 	}
 
-	/**
-	 * @brief	Sets service URI
-	 */
-	inline void setServiceId(std::string serviceId)
-	{
-		this->serviceId = serviceId;
-	}
-
 	/**
 	 * @brief	Returns local node name
 	 */
@@ -378,7 +396,12 @@ public:
 	 */
 	inline void setRemoteId(std::string remoteId)
 	{
+		if (this->remoteId == remoteId)
+			return;
+
+		ChildKey oldKey(this->remoteId, remoteFlowId);
 		this->remoteId = remoteId;
+		remoteIdsChanged(oldKey);
 	}
 
 	/**
@@ -432,25 +455,25 @@ public:
 	}
 
 	/**
-	 * @brief	Adds a flow state as a child of this flow state
+	 * @brief	Adds a flow state as a child of this flow state. The child is
+	 * 			filed under its remote ID and remote flow ID and filed again
+	 * 			whenever they change. Children without remote ID or with IDs
+	 * 			of another child are kept in a list and found by a linear
+	 * 			search, so no child is ever replaced.
 	 */
 	inline void addChildFlowState(boost::shared_ptr<CFlowState> flowState)
 	{
-		childFlowStates.push_back(flowState);
+		flowState->parentFlowState = shared_from_this();
+		indexChildFlowState(flowState);
 	}
 
 	/**
-	 * @brief	Adds a flow state as a child of this flow state
+	 * @brief	Removes a child flow state
 	 */
 	inline void removeChildFlowState(boost::shared_ptr<CFlowState> flowState)
 	{
-		std::list<boost::shared_ptr<CFlowState> >::iterator it;
-		for (it = childFlowStates.begin(); it != childFlowStates.end(); it++) {
-			if (*it == flowState) {
-				childFlowStates.erase(it);
-				break;
-			}
-		}
+		if (unindexChildFlowState(flowState, ChildKey(flowState->remoteId, flowState->remoteFlowId)))
+			flowState->parentFlowState.reset();
 	}
 
 	/**
@@ -458,17 +481,65 @@ public:
 	 */
 	inline boost::shared_ptr<CFlowState> getChildFlowState(const std::string& remoteId, FlowId remoteFlowId)
 	{
-		boost::shared_ptr<CFlowState> fs;
-		std::list<boost::shared_ptr<CFlowState> >::iterator it;
-		for (it = childFlowStates.begin(); it != childFlowStates.end(); it++) {
-			if (((*it)->getRemoteId() == remoteId) and ((*it)->getRemoteFlowId() == remoteFlowId)) {
-				fs = *it;
-				break;
+		boost::unordered_map<ChildKey, boost::shared_ptr<CFlowState> >::const_iterator it;
+		it = childFlowStates.find(ChildKey(remoteId, remoteFlowId));
+		if (it != childFlowStates.end())
+			return it->second;
+
+		std::list<boost::shared_ptr<CFlowState> >::const_iterator lit;
+		for (lit = unkeyedChildFlowStates.begin(); lit != unkeyedChildFlowStates.end(); lit++) {
+			if ((*lit)->remoteId == remoteId && (*lit)->remoteFlowId == remoteFlowId)
+				return *lit;
+		}
+
+		return boost::shared_ptr<CFlowState>();
+	}
+
+private:
+	/// files a child under its current remote IDs if they are free
+	inline void indexChildFlowState(const boost::shared_ptr<CFlowState>& flowState)
+	{
+		if (!flowState->remoteId.empty() &&
+				childFlowStates.insert(std::make_pair(ChildKey(flowState->remoteId, flowState->remoteFlowId), flowState)).second)
+			return;
+
+		unkeyedChildFlowStates.push_back(flowState);
+	}
+
+	/// removes a child filed under key or kept in the list, false if it is no child
+	inline bool unindexChildFlowState(const boost::shared_ptr<CFlowState>& flowState, const ChildKey& key)
+	{
+		boost::unordered_map<ChildKey, boost::shared_ptr<CFlowState> >::iterator it;
+		it = childFlowStates.find(key);
+		if (it != childFlowStates.end() && it->second == flowState) {
+			childFlowStates.erase(it);
+			return true;
+		}
+
+		std::list<boost::shared_ptr<CFlowState> >::iterator lit;
+		for (lit = unkeyedChildFlowStates.begin(); lit != unkeyedChildFlowStates.end(); lit++) {
+			if (*lit == flowState) {
+				unkeyedChildFlowStates.erase(lit);
+				return true;
 			}
 		}
-		return fs;
+
+		return false;
 	}
 
+	/// files a child again after its remote IDs changed from oldKey
+	inline void remoteIdsChanged(const ChildKey& oldKey)
+	{
+		boost::shared_ptr<CFlowState> parent = parentFlowState.lock();
+		if (parent.get() == NULL)
+			return;
+
+		boost::shared_ptr<CFlowState> self = shared_from_this();
+		if (parent->unindexChildFlowState(self, oldKey))
+			parent->indexChildFlowState(self);
+	}
+
+public:
 	/**
 	 * @brief	Return state object with the given name (should be the URI of
 	 * 			the entity which uses the object).
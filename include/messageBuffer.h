@@ -15,16 +15,35 @@
 #include "reboost/src/buffers/buffers.hpp"
 
 #include "messages.h"
+#include "messagePool.h"
 
 #include "debug.h"
 
 #include <stddef.h> // for NULL definition
 #include <stdint.h>
 #include <sys/types.h>
+#include <string.h>
 
 // TODO: fix this include for FreeBSD/Windows
 #include <netinet/in.h>
 
+#include <boost/make_shared.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+#include <map>
+#include <vector>
+
+/// space reserved in front of payload and header buffers for further headers
+/// (see message_t::prepend() and CMessageBuffer::push_header())
+#define MESSAGEBUFFER_HEADROOM 128
+
+/// smallest size class of CSharedBufferPool
+#define CSHAREDBUFFERPOOL_MIN_CLASS 256
+
+/// free buffers kept per size class of CSharedBufferPool
+#define CSHAREDBUFFERPOOL_MAX_FREE 64
+
 using namespace reboost;
 
 class CMessageBuffer;
@@ -44,6 +63,26 @@ public:
 	 */
 	virtual void deserialize(boost::shared_ptr<CMessageBuffer> mbuf) = 0;
 
+	/**
+	 * @brief	Size of the serialized header in bytes, if known in advance.
+	 *
+	 * 			Headers returning a size > 0 must implement serializeInPlace(),
+	 * 			which CMessageBuffer::push_header() then uses instead of
+	 * 			serialize() to avoid a temporary buffer.
+	 */
+	virtual std::size_t getSerializedSize() const
+	{
+		return 0;
+	}
+
+	/**
+	 * @brief	Serialize all relevant data at the cursor of mbuf (using
+	 * 			push_ulong() etc.); exactly getSerializedSize() bytes.
+	 */
+	virtual void serializeInPlace(CMessageBuffer& mbuf) const
+	{
+	}
+
 };
 
 class CMessageBuffer : public IMessage
@@ -125,11 +164,8 @@ public:
 					buffer(mbuf.buffer),
 					cursor(mbuf.cursor)
 	{
-		/// copy properties
-		std::map<PropertyId, boost::shared_ptr<CMorphableValue> >::const_iterator pit;
-		for (pit = mbuf.properties.begin(); pit != mbuf.properties.end(); pit++)
-			if (pit->second != NULL)
-				properties[pit->first] = pit->second->clone();
+		/// share properties (copied on write)
+		copyProperties(mbuf);
 	}
 
 	/**
@@ -145,11 +181,8 @@ public:
 			buffer.push_back(buf);
 		}
 
-        /// copy properties
-		std::map<PropertyId, boost::shared_ptr<CMorphableValue> >::const_iterator pit;
-		for (pit = mbuf.properties.begin(); pit != mbuf.properties.end(); pit++)
-			if (pit->second != NULL)
-				properties[pit->first] = pit->second->clone();
+        /// share properties (copied on write)
+		copyProperties(mbuf);
 	}
 
 	/**
@@ -172,7 +205,7 @@ public:
 		setType(t_outgoing);
 		setFlowState(boost::shared_ptr<CFlowState>());
 		cursor = 0;
-		properties.clear();
+		clearProperties();
 	}
 
 	/**
@@ -248,11 +281,8 @@ public:
 		cl->setType(type);
 		cl->setFlowState(flowState);
 
-		// copy properties
-		std::map<PropertyId, boost::shared_ptr<CMorphableValue> >::const_iterator pit;
-		for (pit = properties.begin(); pit != properties.end(); pit++)
-			if (pit->second != NULL)
-				cl->properties[pit->first] = pit->second->clone();
+		// share properties (copied on write)
+		cl->copyProperties(*this);
 
 		return cl;
 	}
@@ -268,13 +298,26 @@ public:
 		cursor = 0;
 	}
 
+	/**
+	 * @brief	Prepends a message. A message consisting of one buffer (e.g. a
+	 * 			serialized header) is copied into the headroom of our first
+	 * 			buffer if possible instead of adding another buffer.
+	 */
+	inline void prepend(const message_t& msg)
+	{
+		if (msg.length() == 1)
+			buffer.prepend(msg[0]);
+		else
+			buffer.push_front(msg);
+	}
+
 	/**
 	 * @brief	Prepends a message buffer.
 	 */
 	inline void push_front(const CMessageBuffer& msgbuf)
 	{
 		assert(buffer.length() < message_max_buffers-1);
-		buffer.push_front(msgbuf.buffer);
+		prepend(msgbuf.buffer);
 	}
 
 	/**
@@ -283,7 +326,7 @@ public:
 	inline void push_front(const CMessageBuffer* msgbuf)
 	{
 		assert(buffer.length() < message_max_buffers-1);
-		buffer.push_front(msgbuf->buffer);
+		prepend(msgbuf->buffer);
 	}
 
 	/**
@@ -292,7 +335,7 @@ public:
 	inline void push_front(boost::shared_ptr<CMessageBuffer> msgbuf)
 	{
 		assert(buffer.length() < message_max_buffers-1);
-		buffer.push_front(msgbuf->buffer);
+		prepend(msgbuf->buffer);
 	}
 
 	/**
@@ -301,7 +344,7 @@ public:
 	inline void push_front(const shared_buffer_t& buffer)
 	{
 		assert(this->buffer.length() < message_max_buffers-1);
-		this->buffer.push_front(buffer);
+		this->buffer.prepend(buffer);
 	}
 
 	/**
@@ -465,7 +508,7 @@ public:
 	 */
 	inline void push_header(const IHeader& hdr)
 	{
-		push_front(hdr.serialize());
+		push_header_in_place(hdr);
 	}
 
 	/**
@@ -473,7 +516,7 @@ public:
 	 */
 	inline void push_header(const IHeader* hdr)
 	{
-		push_front(hdr->serialize());
+		push_header_in_place(*hdr);
 	}
 
 	/**
@@ -481,7 +524,30 @@ public:
 	 */
 	inline void push_header(boost::shared_ptr<IHeader> hdr)
 	{
-		push_front(hdr->serialize());
+		push_header_in_place(*hdr);
+	}
+
+	/**
+	 * @brief	Serializes the header directly into the front of the buffer,
+	 * 			using the headroom of the first buffer if possible. Falls back
+	 * 			to IHeader::serialize() if the size is not known in advance.
+	 */
+	inline void push_header_in_place(const IHeader& hdr)
+	{
+		std::size_t size = hdr.getSerializedSize();
+		if (size == 0) {
+			push_front(hdr.serialize());
+			return;
+		}
+
+		assert(buffer.length() < message_max_buffers-1);
+		buffer.reserve_front(size, MESSAGEBUFFER_HEADROOM);
+
+		unsigned int c = cursor;
+		cursor = 0;
+		hdr.serializeInPlace(*this);
+		assert(cursor == size);
+		cursor = c;
 	}
 
 	/**
@@ -564,68 +630,133 @@ public:
 /**
  * @brief	Simple class pool.
  *
- * 			For performance reasons, this class is not thread safe!
- * 			Only use within a single thread.
- *
  * 			CMessageBufferPool only manages objects, not the buffer itself.
  * 			You will always get an empty CMessageBuffer when calling get().
  *
- * 			The pool is limited to maxSize, but you will always get an object
- * 			even if the pool is exceeded. The new object simply won't be
- * 			managed by the pool.
+ * 			Object and shared_ptr control block are taken from
+ * 			nena::CMessagePool in a single block, so get() is thread safe
+ * 			and does not scan for unused objects.
  */
 class CMessageBufferPool
 {
-private:
-	static const std::size_t maxSize = 0;
-	std::list<boost::shared_ptr<CMessageBuffer> > buffers;
-
 public:
 	/**
 	 * @brief	Returns an empty CMessageBuffer object
 	 */
 	boost::shared_ptr<CMessageBuffer> get()
 	{
-		std::list<boost::shared_ptr<CMessageBuffer> >::iterator it;
-		for (it = buffers.begin(); it != buffers.end(); it++) {
-			boost::shared_ptr<CMessageBuffer>& p(*it);
-			if (p.unique()) {
-				p->reset();
-				return p;
-			}
-		}
-		boost::shared_ptr<CMessageBuffer> p(new CMessageBuffer((std::size_t) 0));
-		if (buffers.size() < maxSize)
-			buffers.push_back(p);
-		return p;
+		return boost::allocate_shared<CMessageBuffer>(nena::CMessagePoolAllocator<CMessageBuffer>(), (std::size_t) 0);
 	}
 
 };
 
 /**
- * @brief	Pool for fixed-size shared_buffer_t buffers.
+ * @brief	Pool for shared_buffer_t buffers.
  *
- * 			For performance reasons, this class is not thread safe!
- * 			Only use within a single thread.
+ * 			Buffers are taken from a free list per size class (powers of two
+ * 			from CSHAREDBUFFERPOOL_MIN_CLASS up to bufferSize) and return
+ * 			themselves to it when their last reference is dropped, so neither
+ * 			get() nor the release depend on the number of buffers in use.
+ * 			Buffers may be released by any thread. Requests larger than
+ * 			bufferSize are served by a plain shared_buffer_t.
  *
- * 			The pool is limited to maxSize, but you will always get an object
- * 			even if the pool is exceeded. The new object simply won't be
- * 			managed by the pool.
+ * 			The pool keeps at most CSHAREDBUFFERPOOL_MAX_FREE free buffers per
+ * 			size class; buffers still in use when the pool is destroyed are
+ * 			freed on their last release.
  *
- * 			Note, the shared_buffer_t::use_count() MAY be increased by one if
- * 			managed by this pool.
+ * 			New buffers are written once on allocation, so their memory is
+ * 			local to the NUMA node of the thread calling get() (first touch).
+ * 			Use the pool from the thread that fills the buffers.
  */
 class CSharedBufferPool
 {
+public:
+	class Statistics
+	{
+	public:
+		uint64_t hits;		///< get() served from the free list
+		uint64_t misses;	///< get() had to allocate a new buffer
+		uint32_t inUse;		///< buffers currently handed out
+		uint32_t peak;		///< maximum of inUse
+
+		Statistics() : hits(0), misses(0), inUse(0), peak(0) {}
+	};
+
 private:
-	static const std::size_t maxSize = 64;
-	std::list<shared_buffer_t> buffers;
+	/**
+	 * @brief	Free list of a single size class, referenced by every buffer
+	 * 			handed out from it
+	 */
+	class CSizeClass : public shared_buffer_t::recycler
+	{
+	public:
+		const bsize_t size;
+		boost::mutex mutex;
+		std::vector<boctet_t *> free;
+		Statistics stat;
+
+		CSizeClass(bsize_t size) : size(size) {}
+
+		virtual ~CSizeClass()
+		{
+			for (std::size_t i = 0; i < free.size(); i++)
+				delete[] free[i];
+		}
+
+		shared_buffer_t get(const boost::shared_ptr<CSizeClass>& self, bsize_t length)
+		{
+			boctet_t * data = NULL;
+			{
+				boost::lock_guard<boost::mutex> lock(mutex);
+				if (!free.empty()) {
+					data = free.back();
+					free.pop_back();
+					stat.hits++;
+				} else {
+					stat.misses++;
+				}
+
+				if (++stat.inUse > stat.peak)
+					stat.peak = stat.inUse;
+			}
+
+			if (data == NULL) {
+				data = new boctet_t[size];
+				memset(data, 0, size);
+			}
+
+			return shared_buffer_t(data, length, self);
+		}
+
+		virtual void recycle(boctet_t * data)
+		{
+			{
+				boost::lock_guard<boost::mutex> lock(mutex);
+				stat.inUse--;
+				if (free.size() < CSHAREDBUFFERPOOL_MAX_FREE) {
+					free.push_back(data);
+					return;
+				}
+			}
+
+			delete[] data;
+		}
+	};
+
+	std::vector<boost::shared_ptr<CSizeClass> > classes;
 	std::size_t bufferSize;
 
 public:
 	CSharedBufferPool(std::size_t bufferSize) :
 			bufferSize(bufferSize)
 	{
+		std::size_t size = CSHAREDBUFFERPOOL_MIN_CLASS;
+		while (size < bufferSize) {
+			classes.push_back(boost::shared_ptr<CSizeClass>(new CSizeClass(size)));
+			size <<= 1;
+		}
+
+		classes.push_back(boost::shared_ptr<CSizeClass>(new CSizeClass(bufferSize)));
 	}
 
 	virtual ~CSharedBufferPool()
@@ -637,17 +768,37 @@ public:
 	 */
 	shared_buffer_t get()
 	{
-		std::list<shared_buffer_t>::iterator it;
-		for (it = buffers.begin(); it != buffers.end(); it++) {
-			shared_buffer_t& p(*it);
-			if (p.use_count() == 1) {
-				return p;
-			}
+		return classes.back()->get(classes.back(), bufferSize);
+	}
+
+	/**
+	 * @brief	Returns a shared buffer with the given size, taken from the
+	 * 			smallest size class it fits in
+	 */
+	shared_buffer_t get(std::size_t size)
+	{
+		if (size > bufferSize) {
+			shared_buffer_t p(size);
+			memset(p.mutable_data(), 0, size);
+			return p;
+		}
+
+		std::size_t c = 0;
+		while (classes[c]->size < size)
+			c++;
+
+		return classes[c]->get(classes[c], size);
+	}
+
+	/**
+	 * @brief	Return the statistics of all size classes (class size -> counters)
+	 */
+	void getStatistics(std::map<std::size_t, Statistics>& stats)
+	{
+		for (std::size_t c = 0; c < classes.size(); c++) {
+			boost::lock_guard<boost::mutex> lock(classes[c]->mutex);
+			stats[classes[c]->size] = classes[c]->stat;
 		}
-		shared_buffer_t p(bufferSize);
-		if (buffers.size() < maxSize)
-			buffers.push_back(p);
-		return p;
 	}
 
 };
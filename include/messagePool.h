@@ -0,0 +1,103 @@
+/** @file
+ * messagePool.h
+ *
+ * @brief Freelist allocator for messages
+ *
+ * (c) 2008-2012 Institut fuer Telematik, KIT, Germany
+ */
+
+#ifndef MESSAGEPOOL_H_
+#define MESSAGEPOOL_H_
+
+#include <cstddef>
+#include <new>
+
+/// granularity of the size classes in bytes
+#define MESSAGEPOOL_GRANULARITY 64
+
+/// number of size classes, larger objects are not pooled
+#define MESSAGEPOOL_CLASSES 16
+
+/// free blocks a thread keeps per size class before it hands a batch to the depot
+#define MESSAGEPOOL_THREAD_CACHE 256
+
+/// maximum number of batches per size class in the global depot
+#define MESSAGEPOOL_DEPOT_BATCHES 64
+
+namespace nena
+{
+
+/**
+ * @brief	Freelist allocator for messages and other short-lived objects
+ *
+ * 			Each thread keeps a list of free blocks per size class, so
+ * 			allocation and deallocation do not lock. Messages are usually
+ * 			freed by another thread than the one that created them (e.g. the
+ * 			I/O thread creates, a worker frees). Surplus blocks are therefore
+ * 			moved to a global depot in batches of MESSAGEPOOL_THREAD_CACHE / 2,
+ * 			and threads with an empty list pick up a whole batch at once.
+ */
+class CMessagePool
+{
+public:
+	static void * allocate(std::size_t size);
+	static void deallocate(void * p, std::size_t size);
+};
+
+/**
+ * @brief	STL compatible allocator on top of CMessagePool
+ *
+ * 			Use with boost::allocate_shared() to get the object and the
+ * 			shared_ptr control block in a single pooled block.
+ */
+template<class T>
+class CMessagePoolAllocator
+{
+public:
+	typedef T value_type;
+	typedef T * pointer;
+	typedef const T * const_pointer;
+	typedef T & reference;
+	typedef const T & const_reference;
+	typedef std::size_t size_type;
+	typedef std::ptrdiff_t difference_type;
+
+	template<class U>
+	struct rebind
+	{
+		typedef CMessagePoolAllocator<U> other;
+	};
+
+	CMessagePoolAllocator() {}
+
+	template<class U>
+	CMessagePoolAllocator(const CMessagePoolAllocator<U>&) {}
+
+	pointer address(reference x) const { return &x; }
+	const_pointer address(const_reference x) const { return &x; }
+
+	pointer allocate(size_type n, const void * = 0)
+	{
+		return static_cast<pointer>(CMessagePool::allocate(n * sizeof(T)));
+	}
+
+	void deallocate(pointer p, size_type n)
+	{
+		CMessagePool::deallocate(p, n * sizeof(T));
+	}
+
+	size_type max_size() const { return std::size_t(-1) / sizeof(T); }
+
+	void construct(pointer p, const T& val) { ::new ((void *) p) T(val); }
+	void destroy(pointer p) { p->~T(); }
+};
+
+template<class T, class U>
+inline bool operator==(const CMessagePoolAllocator<T>&, const CMessagePoolAllocator<U>&) { return true; }
+
+template<class T, class U>
+inline bool operator!=(const CMessagePoolAllocator<T>&, const CMessagePoolAllocator<U>&) { return false; }
+
+} // namespace nena
+
+#endif /* MESSAGEPOOL_H_ */
@@ -23,9 +23,12 @@
 
 #include "debug.h"
 #include "morphableValue.h"
+#include "atomics.h"
+#include "messagePool.h"
 
 // for NULL definition
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef DEBUG_MESSAGES_PROFILE
 // perf test
@@ -34,13 +37,16 @@
 #endif // DEBUG_MESSAGES_PROFILE
 #include <list>
 #include <map>
+#include <vector>
 #include <exception>
 #include <exceptions.h>
 #include <string>
 
 #include <boost/enable_shared_from_this.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
 
+class IMessage;
 class IMessageProcessor;
 class IMessageScheduler;
 class CNena;
@@ -79,6 +85,24 @@ inline hash_t hash_string(std::string s)
 }
 }
 
+/**
+ * @brief	Hook for intrusive message queues.
+ *
+ * 			Only touched by the message queue the message currently sits in.
+ * 			It is never copied along with the message.
+ */
+class CMessageLink
+{
+public:
+	nena::atomic<CMessageLink *> next;
+	boost::shared_ptr<IMessage> self;	///< keeps the message alive while queued
+	uint64_t stamp;						///< enqueue time for telemetry (scheduler specific clock)
+
+	CMessageLink() : next(NULL), stamp(0) {}
+	CMessageLink(const CMessageLink&) : next(NULL), stamp(0) {}
+	CMessageLink& operator=(const CMessageLink&) { return *this; }
+};
+
 /**
  * @brief	Generic message interface.
  *
@@ -116,6 +140,7 @@ public:
 		p_optString,        // option string containing meta data
 		p_method,			// method (command mode, IAppConnector::method_t)
 		p_endOfStream,		// end of message stream (bool)
+		p_fixedMax,			// number of built-in properties (internal)
 		p_userBase = 1000
 	};
 
@@ -142,10 +167,88 @@ protected:
 
 	/**
 	 * @brief	Cross-"layer" properties.
+	 *
+	 * 			Built-in properties are stored in a fixed slot indexed by their
+	 * 			ID, so the hot path does not allocate map nodes. Only properties
+	 * 			from p_userBase on end up in the map.
+	 *
+	 * 			The set is shared between clones of a message and copied on the
+	 * 			first write. The values are shared as well, so they must not be
+	 * 			modified in place; use setProperty() with a new value instead.
+	 */
+	class CPropertySet
+	{
+	public:
+		boost::shared_ptr<CMorphableValue> fixed[p_fixedMax];
+		std::map<PropertyId, boost::shared_ptr<CMorphableValue> > user;
+	};
+
+	boost::shared_ptr<CPropertySet> properties;	///< NULL if no property was set yet
+
+	/**
+	 * @brief	Return the value of a property or NULL if it is not set
+	 */
+	inline const boost::shared_ptr<CMorphableValue> * findProperty(const PropertyId pid) const
+	{
+		if (properties.get() == NULL)
+			return NULL;
+
+		if ((unsigned int) pid < p_fixedMax)
+			return properties->fixed[pid].get() != NULL ? &properties->fixed[pid] : NULL;
+
+		std::map<PropertyId, boost::shared_ptr<CMorphableValue> >::const_iterator pit;
+		pit = properties->user.find(pid);
+		return pit != properties->user.end() ? &pit->second : NULL;
+	}
+
+	/**
+	 * @brief	Return a property set that is not shared with other messages
+	 */
+	inline CPropertySet & writableProperties()
+	{
+		if (properties.get() == NULL)
+			properties = boost::make_shared<CPropertySet>();
+		else if (!properties.unique())
+			properties = boost::make_shared<CPropertySet>(*properties);
+
+		return *properties;
+	}
+
+	/**
+	 * @brief	Set a property, a NULL value erases it
 	 */
-	std::map<PropertyId, boost::shared_ptr<CMorphableValue> > properties;
+	inline void storeProperty(const PropertyId pid, const boost::shared_ptr<CMorphableValue>& val)
+	{
+		if (val.get() == NULL && findProperty(pid) == NULL)
+			return; // nothing to erase, avoid copying a shared set
+
+		if ((unsigned int) pid < p_fixedMax)
+			writableProperties().fixed[pid] = val;
+		else if (val.get() != NULL)
+			writableProperties().user[pid] = val;
+		else
+			writableProperties().user.erase(pid);
+	}
+
+	/**
+	 * @brief	Take over the properties of msg (shared until one of the
+	 * 			messages sets a property)
+	 */
+	void copyProperties(const IMessage& msg)
+	{
+		properties = msg.properties;
+	}
+
+	/**
+	 * @brief	Erase all properties
+	 */
+	void clearProperties()
+	{
+		properties.reset();
+	}
 
 public:
+	CMessageLink queueLink;		///< reserved for message queues
 
 #ifdef DEBUG_MESSAGES_LOOPDETECTION
 	// for debugging: detect message loops
@@ -171,7 +274,19 @@ public:
 	 */
 	virtual ~IMessage()
 	{
-		properties.clear();
+	}
+
+	/**
+	 * @brief	Messages of all types are allocated from nena::CMessagePool
+	 */
+	static void * operator new(std::size_t size)
+	{
+		return nena::CMessagePool::allocate(size);
+	}
+
+	static void operator delete(void * p, std::size_t size)
+	{
+		nena::CMessagePool::deallocate(p, size);
 	}
 
 	// setters & getters
@@ -291,18 +406,7 @@ public:
 	 */
 	inline void setProperty(const PropertyId pid, boost::shared_ptr<CMorphableValue> val)
 	{
-		std::map<PropertyId, boost::shared_ptr<CMorphableValue> >::iterator pit;
-		pit = properties.find(pid);
-		if (pit != properties.end()) {
-			if (val.get() == 0) {
-				properties.erase(pit);
-				return;
-			}
-
-		}
-
-		if (val.get() != 0)
-			properties[pid] = val;
+		storeProperty(pid, val);
 	}
 
 	/**
@@ -312,18 +416,7 @@ public:
 	template<class T>
 	inline void setProperty(const PropertyId pid, boost::shared_ptr<T> val)
 	{
-		std::map<PropertyId, boost::shared_ptr<CMorphableValue> >::iterator pit;
-		pit = properties.find(pid);
-		if (pit != properties.end()) {
-			if (val.get() == 0) {
-				properties.erase(pit);
-				return;
-			}
-
-		}
-
-		if (val.get() != 0)
-			properties[pid] = val;
+		storeProperty(pid, val);
 	}
 
 	/**
@@ -333,18 +426,7 @@ public:
 	template<class T>
 	inline void setProperty(const PropertyId pid, T* val)
 	{
-		std::map<PropertyId, boost::shared_ptr<CMorphableValue> >::iterator pit;
-		pit = properties.find(pid);
-		if (pit != properties.end()) {
-			if (val == 0) {
-				properties.erase(pit);
-				return;
-			}
-
-		}
-
-		if (val != 0)
-			properties[pid] = boost::shared_ptr<CMorphableValue>(val);
+		storeProperty(pid, boost::shared_ptr<CMorphableValue>(val));
 	}
 
 	/**
@@ -364,10 +446,9 @@ public:
 	boost::shared_ptr<T> getProperty(const PropertyId pid) throw (EPropertyNotDefined,
 			CMorphableValue::EValueTypeMismatch)
 	{
-		std::map<PropertyId, boost::shared_ptr<CMorphableValue> >::iterator pit;
-		pit = properties.find(pid);
-		if (pit != properties.end()) {
-			boost::shared_ptr<T> r = pit->second->cast<T>();
+		const boost::shared_ptr<CMorphableValue> * val = findProperty(pid);
+		if (val != NULL) {
+			boost::shared_ptr<T> r = (*val)->cast<T>();
 			return r;
 
 		} else {
@@ -385,10 +466,9 @@ public:
 	 */
 	const boost::shared_ptr<CMorphableValue> getProperty(const PropertyId pid) throw (EPropertyNotDefined)
 	{
-		std::map<PropertyId, boost::shared_ptr<CMorphableValue> >::iterator pit;
-		pit = properties.find(pid);
-		if (pit != properties.end()) {
-			return pit->second;
+		const boost::shared_ptr<CMorphableValue> * val = findProperty(pid);
+		if (val != NULL) {
+			return *val;
 
 		} else {
 			throw EPropertyNotDefined();
@@ -410,10 +490,9 @@ public:
 	 */
 	bool hasProperty(const PropertyId pid, boost::shared_ptr<CMorphableValue>& mv)
 	{
-		std::map<PropertyId, boost::shared_ptr<CMorphableValue> >::iterator pit;
-		pit = properties.find(pid);
-		if (pit != properties.end()) {
-			mv = pit->second; // return a pointer
+		const boost::shared_ptr<CMorphableValue> * val = findProperty(pid);
+		if (val != NULL) {
+			mv = *val; // return a pointer
 			return true;
 
 		} else {
@@ -431,13 +510,7 @@ public:
 	 */
 	bool hasProperty(const PropertyId pid) const
 	{
-		std::map<PropertyId, boost::shared_ptr<CMorphableValue> >::const_iterator pit;
-		pit = properties.find(pid);
-		if (pit != properties.end()) {
-			return true;
-		} else {
-			return false;
-		}
+		return findProperty(pid) != NULL;
 	}
 
 	/**
@@ -562,6 +635,27 @@ public:
 	 */
 	NENA_EXCEPTION(ENotResponsible);
 
+	/**
+	 * @brief	Telemetry of a single message processor
+	 *
+	 * 			Histogram bucket i counts values of 2^i to 2^(i+1)-1 microseconds,
+	 * 			bucket 0 everything below 2 microseconds.
+	 */
+	class CProcessorStatistics
+	{
+	public:
+		std::string processor;					///< processor id
+		uint64_t enqueued;						///< messages sent to the processor
+		double enqueueRate;						///< messages per second since registration
+		uint32_t queueDepth;					///< currently queued messages
+		uint32_t maxQueueDepth;					///< high-water mark of queueDepth
+		std::vector<uint64_t> waitTime;			///< time in queue
+		std::vector<uint64_t> serviceTime;		///< time in processMessage()
+
+		CProcessorStatistics() :
+			enqueued(0), enqueueRate(0), queueDepth(0), maxQueueDepth(0) {}
+	};
+
 private:
 	std::string privateName;	///< name given by config file
 
@@ -759,6 +853,26 @@ public:
 	 */
 	virtual void passMessage(boost::shared_ptr<IMessage> msg) = 0;
 
+	/**
+	 * @brief Append the telemetry of all message processors of this scheduler
+	 *
+	 * Schedulers without telemetry append nothing.
+	 */
+	virtual void getProcessorStatistics(std::list<CProcessorStatistics>& stats)
+	{
+	}
+
+	/**
+	 * @brief Return how many messages were processed per batch
+	 *
+	 * Bucket i counts batches of 2^i to 2^(i+1)-1 messages. Schedulers
+	 * without batching return an empty histogram.
+	 */
+	virtual void getBatchHistogram(std::vector<uint64_t>& histogram) const
+	{
+		histogram.clear();
+	}
+
 };
 
 /**
@@ -1038,6 +1152,29 @@ public:
 		return false;
 	}
 
+	/**
+	 * @brief returns true if the MessageProcessor may be called directly
+	 * 			from within processMessage() of another processor
+	 *
+	 * If so, the scheduler may process messages sent to this processor in
+	 * the sender's thread before sendMessage() returns (run-to-completion).
+	 */
+	virtual bool isReentrant() const
+	{
+		return false;
+	}
+
+	/**
+	 * @brief returns true if the MessageProcessor carries control traffic
+	 * 			(e.g. control Netlets)
+	 *
+	 * Schedulers supporting priorities prefer its data messages over bulk data.
+	 */
+	virtual bool isControlProcessor() const
+	{
+		return false;
+	}
+
 	// event provider methods
 
 	/**
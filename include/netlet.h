@@ -219,6 +219,15 @@ public:
 	 * @brief	Returns the Netlet's meta data
 	 */
 	virtual INetletMetaData* getMetaData() const = 0;
+
+	/**
+	 * @brief	Control Netlets carry control traffic
+	 */
+	virtual bool isControlProcessor() const
+	{
+		INetletMetaData* md = getMetaData();
+		return md != NULL && md->isControlNetlet();
+	}
 };
 
 /// Type for global collection of Netlet factories.
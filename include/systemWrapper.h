@@ -82,6 +82,11 @@ public:
 	 */
 	virtual IMessageScheduler *schedulerFactory() = 0;
 
+	/**
+	 * @brief	Append all schedulers of the system
+	 */
+	virtual void getSchedulers(std::list<IMessageScheduler *>& schedulers) = 0;
+
 	/**
 	 * @brief Returns a system-specific synch Factory
 	 */
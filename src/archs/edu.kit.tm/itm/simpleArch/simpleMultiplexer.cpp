@@ -22,10 +22,13 @@
 
 #include "boost/algorithm/string/trim.hpp"
 #include "boost/algorithm/string/split.hpp"
+#include "boost/make_shared.hpp"
 
 #include <string>
+#include <cstring>
 #include <set>
 #include <algorithm>
+#include <vector>
 
 using namespace std;
 using boost::shared_ptr;
@@ -36,19 +39,41 @@ namespace simpleArch {
 
 /* ========================================================================= */
 
+/// first byte of the compact format, an impossible name length in the legacy format
+#define SIMPLEMULTIPLEXER_COMPACT_MARKER	0xff
+/// current version of the compact format
+#define SIMPLEMULTIPLEXER_COMPACT_VERSION	1
+
+#define SIMPLEMULTIPLEXER_FLAG_AUTOFORWARD	0x01
+#define SIMPLEMULTIPLEXER_FLAG_SRCNAME		0x02
+
+/// seconds a RIX announcing our name is trusted (a few RIX intervals)
+#define SIMPLEMULTIPLEXER_CONFIRM_TIME		10.0
+/// seconds a node name is kept without being announced or heard (many RIX intervals)
+#define SIMPLEMULTIPLEXER_NAME_TIMEOUT		60.0
+/// seconds a fresh name is not refreshed again, so lookups stay on the read lock
+#define SIMPLEMULTIPLEXER_NAME_REFRESH		1.0
+
 /**
  * @brief	Minimum header containing the source and destination IDs
  *
- * Header format is [A][B...][C][D...][EEEE][FFFF][GG][HHHH][II]
+ * Legacy header format is [A][B...][C][D...][EEEE][FFFF][GG][HHHH][II][J]
  * A is the string length of destNodeName (one byte)
  * B is the string of destNodeName (variable length)
  * C is the string length of srcNodeName (one byte)
  * D is the string of srcNodeName (variable length)
- * E is the hash of the Netlet identifier (four bytes)
+ * E are the Netlet, service, destination and source flow hashes (four bytes each)
  * F is the destination IPv4 address (four bytes)
  * G is the destination IP port (two bytes)
  * H is the source IPv4 address (four bytes)
  * I is the source IP port (two bytes)
+ * J is the auto forward flag (one byte)
+ *
+ * Compact header format is [0xff][V][K][LLLL][MMMM][EEEE][FFFF][GG][HHHH][II]([C][D...])
+ * V is the format version (one byte)
+ * K are the flags (one byte), the source name is only present with SIMPLEMULTIPLEXER_FLAG_SRCNAME
+ * L is the destination node ID (four bytes, 0 for broadcasts)
+ * M is the source node ID (four bytes)
  */
 class SimpleMultiplexer_Header : public IHeader
 {
@@ -63,11 +88,18 @@ public:
 	ipv4::CLocatorValue srcIpv4Addr;
 	bool autoForward;
 
+	bool compact;			///< use the compact format
+	bool withSrcName;		///< compact format carries srcNodeName
+	uint32_t destNodeId;	///< compact format only
+	uint32_t srcNodeId;		///< compact format only
+
 	SimpleMultiplexer_Header() :
 		netletHash(0), serviceHash(0),
 		destFlowHash(0), srcFlowHash(0),
 		destIpv4Addr(0), srcIpv4Addr(0),
-		autoForward(true)
+		autoForward(true),
+		compact(false), withSrcName(false),
+		destNodeId(0), srcNodeId(0)
 	{};
 
 	SimpleMultiplexer_Header(const SimpleMultiplexer_Header & rhs) :
@@ -82,10 +114,22 @@ public:
 		destIpv4Addr = rhs.destIpv4Addr;
 		srcIpv4Addr = rhs.srcIpv4Addr;
 		autoForward = rhs.autoForward;
+		compact = rhs.compact;
+		withSrcName = rhs.withSrcName;
+		destNodeId = rhs.destNodeId;
+		srcNodeId = rhs.srcNodeId;
 	};
 
 	inline size_t calcSize() const
 	{
+		if (compact)
+			return sizeof(unsigned char)*3 +
+				sizeof(uint32_t)*2 +
+				sizeof(uint32_t)*4 +
+				sizeof(uint32_t)*2 +
+				sizeof(uint16_t)*2 +
+				(withSrcName ? sizeof(unsigned char) + srcNodeName.size() : 0);
+
 		return destNodeName.size() +
 			srcNodeName.size() +
 			sizeof(unsigned char)*2 +
@@ -102,57 +146,167 @@ public:
 	 */
 	virtual boost::shared_ptr<CMessageBuffer> serialize() const
 	{
-		assert(destNodeName.size() <= 255);
-		assert(srcNodeName.size() <= 255);
-
 		boost::shared_ptr<CMessageBuffer> mbuf(new CMessageBuffer(calcSize()));
+		serializeInPlace(*mbuf);
+		return mbuf;
+	}
 
-		mbuf->push_uchar((unsigned char) destNodeName.size());
-		mbuf->push_string(destNodeName);
+	virtual std::size_t getSerializedSize() const
+	{
+		return calcSize();
+	}
 
-		mbuf->push_uchar((unsigned char) srcNodeName.size());
-		mbuf->push_string(srcNodeName);
+	/**
+	 * @brief 	Serialize all relevant data at the cursor of mbuf.
+	 */
+	virtual void serializeInPlace(CMessageBuffer& mbuf) const
+	{
+		if (compact) {
+			unsigned char flags = 0;
+			if (autoForward)
+				flags |= SIMPLEMULTIPLEXER_FLAG_AUTOFORWARD;
+			if (withSrcName)
+				flags |= SIMPLEMULTIPLEXER_FLAG_SRCNAME;
+
+			mbuf.push_uchar(SIMPLEMULTIPLEXER_COMPACT_MARKER);
+			mbuf.push_uchar(SIMPLEMULTIPLEXER_COMPACT_VERSION);
+			mbuf.push_uchar(flags);
+			mbuf.push_ulong(destNodeId);
+			mbuf.push_ulong(srcNodeId);
 
-		mbuf->push_ulong((uint32_t) netletHash);
-		mbuf->push_ulong((uint32_t) serviceHash);
-		mbuf->push_ulong((uint32_t) destFlowHash);
-		mbuf->push_ulong((uint32_t) srcFlowHash);
+		} else {
+			assert(destNodeName.size() < SIMPLEMULTIPLEXER_COMPACT_MARKER);
+			assert(srcNodeName.size() <= 255);
 
-		mbuf->push_ulong(destIpv4Addr.getAddr());
-		mbuf->push_ushort(destIpv4Addr.getPort());
-		mbuf->push_ulong(srcIpv4Addr.getAddr());
-		mbuf->push_ushort(srcIpv4Addr.getPort());
+			mbuf.push_uchar((unsigned char) destNodeName.size());
+			mbuf.push_string(destNodeName);
 
-		mbuf->push_uchar((unsigned char) autoForward);
+			mbuf.push_uchar((unsigned char) srcNodeName.size());
+			mbuf.push_string(srcNodeName);
 
-		return mbuf;
+		}
+
+		mbuf.push_ulong((uint32_t) netletHash);
+		mbuf.push_ulong((uint32_t) serviceHash);
+		mbuf.push_ulong((uint32_t) destFlowHash);
+		mbuf.push_ulong((uint32_t) srcFlowHash);
+
+		mbuf.push_ulong(destIpv4Addr.getAddr());
+		mbuf.push_ushort(destIpv4Addr.getPort());
+		mbuf.push_ulong(srcIpv4Addr.getAddr());
+		mbuf.push_ushort(srcIpv4Addr.getPort());
+
+		if (compact) {
+			if (withSrcName) {
+				assert(srcNodeName.size() <= 255);
+				mbuf.push_uchar((unsigned char) srcNodeName.size());
+				mbuf.push_string(srcNodeName);
+			}
+
+		} else {
+			mbuf.push_uchar((unsigned char) autoForward);
+
+		}
 	}
 
 	/**
-	 * @brief 	De-serialize all relevant data from a byte buffer.
-	 * 			Remember to do Little/Big Endian conversion.
+	 * @brief 	Reads the header without removing it from the buffer.
+	 *
+	 * 			In the compact format, the node names are left empty unless the
+	 * 			source name is carried along; the multiplexer resolves the IDs.
+	 *
+	 * @return	false if the buffer is too short or has an unknown version
 	 */
-	virtual void deserialize(boost::shared_ptr<CMessageBuffer> mbuf)
+	bool peek(CMessageBuffer& mbuf)
 	{
-		unsigned char l;
+		message_t& m = mbuf.getBuffer();
+		size_t off = 0;
+
+		if (m.size() < 1)
+			return false;
 
-		l = mbuf->pop_uchar();
-		destNodeName = mbuf->pop_string(l);
+		unsigned char l = m.read<unsigned char>(off++);
+		compact = (l == SIMPLEMULTIPLEXER_COMPACT_MARKER);
 
-		l = mbuf->pop_uchar();
-		srcNodeName = mbuf->pop_string(l);
+		if (compact) {
+			withSrcName = false;
+			if (m.size() < calcSize())
+				return false;
 
-		netletHash = (nena::hash_t) mbuf->pop_ulong();
-		serviceHash = (nena::hash_t) mbuf->pop_ulong();
-		destFlowHash = (nena::hash_t) mbuf->pop_ulong();
-		srcFlowHash = (nena::hash_t) mbuf->pop_ulong();
+			if (m.read<unsigned char>(off++) != SIMPLEMULTIPLEXER_COMPACT_VERSION)
+				return false;
 
-		destIpv4Addr.setAddr(mbuf->pop_ulong());
-		destIpv4Addr.setPort(mbuf->pop_ushort());
-		srcIpv4Addr.setAddr(mbuf->pop_ulong());
-		srcIpv4Addr.setPort(mbuf->pop_ushort());
+			unsigned char flags = m.read<unsigned char>(off++);
+			autoForward = (flags & SIMPLEMULTIPLEXER_FLAG_AUTOFORWARD) != 0;
+			withSrcName = (flags & SIMPLEMULTIPLEXER_FLAG_SRCNAME) != 0;
 
-		autoForward = mbuf->pop_uchar();
+			destNodeId = ntohl(m.read<uint32_t>(off)); off += sizeof(uint32_t);
+			srcNodeId = ntohl(m.read<uint32_t>(off)); off += sizeof(uint32_t);
+
+		} else {
+			if (m.size() < off + l + 1)
+				return false;
+			destNodeName = readString(m, off, l);
+			off += l;
+
+			l = m.read<unsigned char>(off++);
+			if (m.size() < off + l)
+				return false;
+			srcNodeName = readString(m, off, l);
+			off += l;
+
+			if (m.size() < calcSize())
+				return false;
+
+		}
+
+		netletHash = (nena::hash_t) ntohl(m.read<uint32_t>(off)); off += sizeof(uint32_t);
+		serviceHash = (nena::hash_t) ntohl(m.read<uint32_t>(off)); off += sizeof(uint32_t);
+		destFlowHash = (nena::hash_t) ntohl(m.read<uint32_t>(off)); off += sizeof(uint32_t);
+		srcFlowHash = (nena::hash_t) ntohl(m.read<uint32_t>(off)); off += sizeof(uint32_t);
+
+		destIpv4Addr.setAddr(ntohl(m.read<uint32_t>(off))); off += sizeof(uint32_t);
+		destIpv4Addr.setPort(ntohs(m.read<uint16_t>(off))); off += sizeof(uint16_t);
+		srcIpv4Addr.setAddr(ntohl(m.read<uint32_t>(off))); off += sizeof(uint32_t);
+		srcIpv4Addr.setPort(ntohs(m.read<uint16_t>(off))); off += sizeof(uint16_t);
+
+		if (compact) {
+			if (withSrcName) {
+				if (m.size() < off + 1)
+					return false;
+				l = m.read<unsigned char>(off++);
+				if (m.size() < off + l)
+					return false;
+				srcNodeName = readString(m, off, l);
+			}
+
+		} else {
+			autoForward = m.read<unsigned char>(off);
+
+		}
+
+		return true;
+	}
+
+	/**
+	 * @brief 	De-serialize all relevant data from a byte buffer.
+	 * 			Remember to do Little/Big Endian conversion.
+	 */
+	virtual void deserialize(boost::shared_ptr<CMessageBuffer> mbuf)
+	{
+		if (!peek(*mbuf))
+			throw IMessageProcessor::EUnhandledMessage("SimpleMultiplexer_Header: malformed header");
+
+		mbuf->remove_front(calcSize());
+	}
+
+private:
+	static std::string readString(message_t& m, size_t off, size_t len)
+	{
+		std::string s(len, '\0');
+		if (len > 0)
+			m.read((boctet_t*) &s[0], off, len);
+		return s;
 	}
 };
 
@@ -423,6 +577,413 @@ shared_buffer_t CSimpleNameAddrMapper::resolveId(const std::string& name)
 
 /* ========================================================================= */
 
+/**
+ * @brief	Returns the node ID of a name (0 is reserved for "no node")
+ */
+uint32_t CNodeIdTable::toId(const std::string& name)
+{
+	return nena::hash_string(name);
+}
+
+/**
+ * @brief	Adds or refreshes a name, returns its ID or 0 on conflicts
+ */
+uint32_t CNodeIdTable::intern(const std::string& name, double now, Source source)
+{
+	uint32_t id = toId(name);
+	if (id == 0 || name.empty() || name.size() > 255)
+		return 0;
+
+	{
+		boost::shared_lock<boost::shared_mutex> rl(mutex);
+		map<uint32_t, Entry>::const_iterator it = entries.find(id);
+		if (it != entries.end() && !it->second.conflict && it->second.name->value() == name &&
+				now - it->second.learnt < SIMPLEMULTIPLEXER_NAME_REFRESH &&
+				(source != s_heard || now - it->second.heard < SIMPLEMULTIPLEXER_NAME_REFRESH) &&
+				(source != s_local || it->second.local))
+			return id;
+	}
+
+	boost::unique_lock<boost::shared_mutex> wl(mutex);
+	map<uint32_t, Entry>::iterator it = entries.find(id);
+	if (it == entries.end()) {
+		it = entries.insert(std::make_pair(id, Entry())).first;
+		it->second.name = boost::make_shared<CStringValue>(name);
+		DBG_DEBUG(FMT("CNodeIdTable: %1% is node ID %2$08x") % name % id);
+
+	} else if (it->second.conflict || it->second.name->value() != name) {
+		if (!it->second.conflict)
+			DBG_WARNING(FMT("CNodeIdTable: %1% and %2% share node ID %3$08x") % name % it->second.name->value() % id);
+
+		// the conflict lasts while one of the names is around
+		it->second.conflict = true;
+		it->second.learnt = now;
+		return 0;
+
+	}
+
+	it->second.learnt = now;
+	if (source != s_announced)
+		it->second.heard = now;
+	if (source == s_local)
+		it->second.local = true;
+
+	return id;
+}
+
+/**
+ * @brief	Returns the name of an ID, NULL if unknown or conflicting
+ */
+boost::shared_ptr<CStringValue> CNodeIdTable::lookup(uint32_t id) const
+{
+	boost::shared_lock<boost::shared_mutex> rl(mutex);
+	map<uint32_t, Entry>::const_iterator it = entries.find(id);
+	if (it == entries.end() || it->second.conflict)
+		return boost::shared_ptr<CStringValue>();
+
+	return it->second.name;
+}
+
+/**
+ * @brief	Returns the system time a name was learnt, -1 if unknown or conflicting
+ */
+double CNodeIdTable::learntAt(const std::string& name) const
+{
+	uint32_t id = toId(name);
+
+	boost::shared_lock<boost::shared_mutex> rl(mutex);
+	map<uint32_t, Entry>::const_iterator it = entries.find(id);
+	if (it == entries.end() || it->second.conflict || it->second.name->value() != name)
+		return -1;
+
+	return it->second.learnt;
+}
+
+/**
+ * @brief	Appends the names to announce, at most max
+ *
+ * 			Our own name comes first, then the names of the nodes we heard
+ * 			from most recently. Names only learnt from announcements are not
+ * 			passed on.
+ */
+void CNodeIdTable::getNames(std::list<std::string>& names, double now, std::size_t max) const
+{
+	std::vector<std::pair<double, std::string> > heard;
+	std::size_t n = 0;
+
+	{
+		boost::shared_lock<boost::shared_mutex> rl(mutex);
+		map<uint32_t, Entry>::const_iterator it;
+		for (it = entries.begin(); it != entries.end(); it++) {
+			if (it->second.conflict)
+				continue;
+
+			if (it->second.local) {
+				if (n < max) {
+					names.push_back(it->second.name->value());
+					n++;
+				}
+
+			} else if (it->second.heard >= 0 && now - it->second.heard < SIMPLEMULTIPLEXER_NAME_TIMEOUT) {
+				heard.push_back(std::make_pair(-it->second.heard, it->second.name->value()));
+
+			}
+		}
+	}
+
+	std::size_t k = std::min(heard.size(), max - n);
+	std::partial_sort(heard.begin(), heard.begin() + k, heard.end());
+	for (std::size_t i = 0; i < k; i++)
+		names.push_back(heard[i].second);
+}
+
+/**
+ * @brief	Removes names neither announced nor heard for a while
+ */
+void CNodeIdTable::expire(double now)
+{
+	boost::unique_lock<boost::shared_mutex> wl(mutex);
+	map<uint32_t, Entry>::iterator it = entries.begin();
+	while (it != entries.end()) {
+		if (!it->second.local && now - it->second.learnt >= SIMPLEMULTIPLEXER_NAME_TIMEOUT) {
+			DBG_DEBUG(FMT("CNodeIdTable: %1% (node ID %2$08x) expired") % it->second.name->value() % it->first);
+			entries.erase(it++);
+
+		} else {
+			it++;
+
+		}
+	}
+}
+
+/**
+ * @brief	Records whether the last RIX of a node announced our name
+ *
+ * 			A restarted node announces only the names it learnt since, so
+ * 			the confirmation is dropped again by its next RIX.
+ */
+void CNodeIdTable::setKnowsLocalName(const std::string& name, bool knows, double now)
+{
+	boost::unique_lock<boost::shared_mutex> wl(mutex);
+	map<uint32_t, Entry>::iterator it = entries.find(toId(name));
+	if (it == entries.end() || it->second.conflict || it->second.name->value() != name)
+		return;
+
+	it->second.confirmed = knows ? now : -1;
+}
+
+/**
+ * @brief	Returns true if a recent RIX of the node announced our name
+ */
+bool CNodeIdTable::knowsLocalName(const std::string& name, double now) const
+{
+	boost::shared_lock<boost::shared_mutex> rl(mutex);
+	map<uint32_t, Entry>::const_iterator it = entries.find(toId(name));
+	if (it == entries.end() || it->second.conflict || it->second.name->value() != name)
+		return false;
+
+	return it->second.confirmed >= 0 && now - it->second.confirmed < SIMPLEMULTIPLEXER_CONFIRM_TIME;
+}
+
+/* ========================================================================= */
+
+static inline std::size_t fibHash(const ipv4::CLocatorValue& loc)
+{
+	uint32_t h = (uint32_t) loc.getAddr() * 0x9e3779b1u + loc.getPort();
+	return h ^ (h >> 16);
+}
+
+/**
+ * @brief	Fills the route, publishes it if it was unused
+ */
+void CSimpleFib::CRoute::set(const SimpleFib_Entry& entry)
+{
+	destLoc = entry.destLoc;
+	nextHopLoc = entry.nextHopLoc;
+	netAdapt = entry.netAdapt;
+	hops = entry.hops;
+	touch(entry.timeStamp);
+	used.store(true, nena::memory_order_release);
+}
+
+SimpleFib_Entry CSimpleFib::CRoute::get() const
+{
+	return SimpleFib_Entry(destLoc, nextHopLoc, netAdapt, hops, getTimeStamp());
+}
+
+double CSimpleFib::CRoute::getTimeStamp() const
+{
+	uint64_t bits = timeStampBits.load(nena::memory_order_relaxed);
+	double t;
+	memcpy(&t, &bits, sizeof(t));
+	return t;
+}
+
+void CSimpleFib::CRoute::touch(double now) const
+{
+	uint64_t bits;
+	memcpy(&bits, &now, sizeof(bits));
+	timeStampBits.store(bits, nena::memory_order_relaxed);
+}
+
+/**
+ * @brief	Allocates a table with a load factor of at most 1/2 for minCount routes
+ */
+CSimpleFib::CTable::CTable(std::size_t minCount) :
+		count(0)
+{
+	std::size_t size = SIMPLEMULTIPLEXER_FIB_SIZE;
+	while (size < 2 * minCount)
+		size *= 2;
+
+	mask = size - 1;
+	slots = new CRoute[size];
+}
+
+CSimpleFib::CTable::~CTable()
+{
+	delete [] slots;
+}
+
+const CSimpleFib::CRoute * CSimpleFib::CTable::find(const ipv4::CLocatorValue& dest) const
+{
+	std::size_t i = fibHash(dest) & mask;
+	while (slots[i].used.load(nena::memory_order_acquire)) {
+		if (slots[i].destLoc == dest)
+			return &slots[i];
+
+		i = (i + 1) & mask;
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief	Adds or replaces a route. Replacing is only allowed before the
+ * 			table is published, adding needs room (hasRoom()).
+ */
+void CSimpleFib::CTable::insert(const SimpleFib_Entry& entry)
+{
+	std::size_t i = fibHash(entry.destLoc) & mask;
+	while (slots[i].used.load(nena::memory_order_relaxed) && slots[i].destLoc != entry.destLoc)
+		i = (i + 1) & mask;
+
+	if (!slots[i].used.load(nena::memory_order_relaxed))
+		count++;
+
+	slots[i].set(entry);
+}
+
+/**
+ * @brief	Returns an unpublished copy with room for minCount routes
+ */
+CSimpleFib::CTable * CSimpleFib::CTable::copy(std::size_t minCount) const
+{
+	CTable * t = new CTable(minCount);
+	for (std::size_t i = 0; i <= mask; i++) {
+		if (slots[i].used.load(nena::memory_order_relaxed))
+			t->insert(slots[i].get());
+	}
+
+	return t;
+}
+
+CSimpleFib::CSimpleFib() :
+		table(new CTable(0))
+{
+}
+
+CSimpleFib::~CSimpleFib()
+{
+	delete table.load();
+}
+
+void CSimpleFib::add(const SimpleFib_Entry& entry, bool replace)
+{
+	CTable * old;
+	{
+		boost::lock_guard<boost::mutex> lock(mutex);
+
+		CTable * current = table.load(nena::memory_order_relaxed);
+		const CRoute * r = current->find(entry.destLoc);
+		if (r != NULL && !replace)
+			return;
+
+		if (r == NULL && current->hasRoom()) {
+			current->insert(entry);
+			return;
+		}
+
+		CTable * t = current->copy(current->count + 1);
+		t->insert(entry);
+		old = table.exchange(t);
+	}
+
+	nena::CEpoch::retire(old);
+}
+
+unsigned int CSimpleFib::merge(const std::list<SimpleFib_Entry>& entries, double now)
+{
+	unsigned int added = 0;
+	CTable * old;
+	{
+		boost::lock_guard<boost::mutex> lock(mutex);
+
+		// add new destinations in place while there is room
+		CTable * current = table.load(nena::memory_order_relaxed);
+		bool rebuild = false;
+		list<SimpleFib_Entry>::const_iterator it;
+		for (it = entries.begin(); it != entries.end(); it++) {
+			const CRoute * r = current->find(it->destLoc);
+			if (r == NULL && current->hasRoom()) {
+				current->insert(*it);
+				added++;
+
+			} else if (r == NULL || it->hops < r->hops) {
+				rebuild = true;
+
+			}
+		}
+
+		if (!rebuild)
+			return added;
+
+		// shorter routes and what did not fit go into a single new table
+		CTable * t = current->copy(current->count + entries.size());
+		for (it = entries.begin(); it != entries.end(); it++) {
+			const CRoute * r = t->find(it->destLoc);
+			if (r == NULL) {
+				t->insert(*it);
+				added++;
+
+			} else if (it->hops < r->hops) {
+				SimpleFib_Entry e(*it);
+				e.timeStamp = now;
+				t->insert(e);
+
+			}
+		}
+
+		old = table.exchange(t);
+	}
+
+	nena::CEpoch::retire(old);
+	return added;
+}
+
+void CSimpleFib::remove(const ipv4::CLocatorValue& dest)
+{
+	CTable * old;
+	{
+		boost::lock_guard<boost::mutex> lock(mutex);
+
+		const CTable * current = table.load(nena::memory_order_relaxed);
+		if (current->find(dest) == NULL)
+			return;
+
+		CTable * t = new CTable(current->count);
+		for (std::size_t i = 0; i <= current->mask; i++) {
+			if (current->slots[i].used.load(nena::memory_order_relaxed) && current->slots[i].destLoc != dest)
+				t->insert(current->slots[i].get());
+		}
+
+		old = table.exchange(t);
+	}
+
+	nena::CEpoch::retire(old);
+}
+
+void CSimpleFib::clear()
+{
+	CTable * old;
+	{
+		boost::lock_guard<boost::mutex> lock(mutex);
+		old = table.exchange(new CTable(0));
+	}
+
+	nena::CEpoch::retire(old);
+}
+
+CSimpleFib::CReader::CReader(CSimpleFib& fib) :
+		table(fib.table.load())
+{
+}
+
+const CSimpleFib::CRoute * CSimpleFib::CReader::find(const ipv4::CLocatorValue& dest) const
+{
+	return table->find(dest);
+}
+
+void CSimpleFib::CReader::getAll(SimpleFib& routes) const
+{
+	for (std::size_t i = 0; i <= table->mask; i++) {
+		if (table->slots[i].used.load(nena::memory_order_acquire))
+			routes[table->slots[i].destLoc] = table->slots[i].get();
+	}
+}
+
+/* ========================================================================= */
+
 /**
  * Constructor
  */
@@ -449,6 +1010,14 @@ CSimpleMultiplexer::CSimpleMultiplexer(IMultiplexerMetaData *metaData, CNena *no
 
 	// transitional
 	localAddr = nameAddrMapper->resolve(nodeArch->getNodeName());
+
+	compactHeader = true;
+	if (nodeArch->getConfig()->hasParameter(getId(), "compactHeader", XMLFile::BOOL, XMLFile::VALUE))
+		nodeArch->getConfig()->getParameter(getId(), "compactHeader", compactHeader);
+
+	// the routing Netlet announces our own name along with the learnt ones
+	localNodeId = nodeIds.intern(nodeArch->getNodeName(), nodeArch->getSysTime(), CNodeIdTable::s_local);
+	localNodeName = boost::make_shared<CStringValue>(nodeArch->getNodeName());
 }
 
 /**
@@ -623,6 +1192,22 @@ void CSimpleMultiplexer::processOutgoing(boost::shared_ptr<IMessage> msg) throw
 	if (msg->hasProperty(IMessage::p_autoForward, mv))
 		hdr.autoForward = mv->cast<CBoolValue>()->value();
 
+	// compact header if the destination announced its name, i.e. it knows the format
+	if (compactHeader && !isBroadcast && localNodeId != 0) {
+		double learnt = nodeIds.learntAt(hdr.destNodeName);
+		if (learnt >= 0) {
+			hdr.compact = true;
+			hdr.destNodeId = CNodeIdTable::toId(hdr.destNodeName);
+			hdr.srcNodeId = CNodeIdTable::toId(hdr.srcNodeName);
+
+			// until the destination's RIX shows that it can resolve our ID
+			// (never for nodes that are not neighbours)
+			hdr.withSrcName = hdr.srcNodeId != localNodeId ||
+					!nodeIds.knowsLocalName(hdr.destNodeName, nodeArch->getSysTime());
+
+		}
+	}
+
 //	if (hdr.srcFlowHash != 0 or hdr.destFlowHash != 0) {
 //		DBG_INFO(FMT("%1%: send flow [%2%(%3%), %4%(%5%)]") % getId() %
 //				hdr.srcNodeName % hdr.srcFlowHash %
@@ -655,26 +1240,26 @@ void CSimpleMultiplexer::processOutgoing(boost::shared_ptr<IMessage> msg) throw
 
 		// iterate through locator list
 		bool sent = false;
+		CSimpleFib::CReader fibReader(fib);
 		list<shared_ptr<ipv4::CLocatorValue> >::iterator dit;
 		for (dit = destLocList.list().begin(); dit != destLocList.list().end(); dit++) {
-			SimpleFib::iterator it;
-			it = fib.find(*(*dit));
-			if (it != fib.end()) {
-				if (netAdapt == it->second.netAdapt || netAdapt == NULL) {
+			const CSimpleFib::CRoute * route = fibReader.find(*(*dit));
+			if (route != NULL) {
+				if (netAdapt == route->netAdapt || netAdapt == NULL) {
 					// forced netAdapt or first entry
-					hdr.srcIpv4Addr = ipv4::CLocatorValue(it->second.netAdapt->getProperty<CStringValue>(INetAdapt::p_addr)->value());
-					hdr.destIpv4Addr = it->first;
+					hdr.srcIpv4Addr = ipv4::CLocatorValue(route->netAdapt->getProperty<CStringValue>(INetAdapt::p_addr)->value());
+					hdr.destIpv4Addr = route->destLoc;
 
-					if (it->second.nextHopLoc.isValid())
-						msg->setProperty(IMessage::p_nextHopLoc, new ipv4::CLocatorValue(it->second.nextHopLoc));
+					if (route->nextHopLoc.isValid())
+						msg->setProperty(IMessage::p_nextHopLoc, new ipv4::CLocatorValue(route->nextHopLoc));
 
 					mbuf->push_header(hdr);
-					mbuf->setTo(it->second.netAdapt);
+					mbuf->setTo(route->netAdapt);
 					sendMessage(mbuf);
 					sent = true;
 
 					// Update the timestamp for this FIB entry
-					updateTimeStamp(it->second.destLoc);
+					route->touch(nodeArch->getSysTime());
 					break;
 
 				}
@@ -773,10 +1358,51 @@ void CSimpleMultiplexer::processIncoming(boost::shared_ptr<IMessage> msg) throw
 	if (mbuf == NULL) throw EUnhandledMessage("Incoming message not of type CMessageBuffer.");
 	
 	SimpleMultiplexer_Header hdr;
-	mbuf->peek_header(hdr);
+	if (!hdr.peek(*mbuf))
+		throw EUnhandledMessage((FMT("%1%: malformed header") % getId()).str());
+
+	size_t hdrSize = hdr.calcSize();
+	bool relay;
+
+	if (hdr.compact) {
+		relay = hdr.autoForward && hdr.destNodeId != 0 && hdr.destNodeId != localNodeId;
+
+		shared_ptr<CStringValue> srcName;
+		if (hdr.withSrcName) {
+			srcName = nodeIds.lookup(nodeIds.intern(hdr.srcNodeName, nodeArch->getSysTime(), CNodeIdTable::s_heard));
+			if (srcName == NULL) // conflicting ID, but we have the name anyway
+				srcName = boost::make_shared<CStringValue>(hdr.srcNodeName);
+
+		} else {
+			srcName = nodeIds.lookup(hdr.srcNodeId);
+
+		}
+
+		shared_ptr<CStringValue> destName = relay ? nodeIds.lookup(hdr.destNodeId) : localNodeName;
+		if (hdr.destNodeId == 0)
+			destName = boost::make_shared<CStringValue>(std::string());
+
+		if (srcName == NULL && !relay)
+			throw EUnhandledMessage((FMT("%1%: unknown source node ID %2$08x") % getId() % hdr.srcNodeId).str());
+
+		// std::string copies share the buffer
+		if (srcName != NULL) {
+			hdr.srcNodeName = srcName->value();
+			mbuf->setProperty(IMessage::p_srcId, srcName);
+		}
+
+		if (destName != NULL) {
+			hdr.destNodeName = destName->value();
+			mbuf->setProperty(IMessage::p_destId, destName);
+		}
+
+	} else {
+		relay = hdr.autoForward && hdr.destNodeName != "" && hdr.destNodeName != nodeArch->getNodeName();
+
+		mbuf->setProperty(IMessage::p_destId, boost::make_shared<CStringValue>(hdr.destNodeName));
+		mbuf->setProperty(IMessage::p_srcId, boost::make_shared<CStringValue>(hdr.srcNodeName));
 
-	mbuf->setProperty(IMessage::p_destId, new CStringValue(hdr.destNodeName));
-	mbuf->setProperty(IMessage::p_srcId, new CStringValue(hdr.srcNodeName));
+	}
 
 //	if (hdr.srcFlowHash != 0 or hdr.destFlowHash != 0) {
 //		DBG_INFO(FMT("%1%: recv flow [%2%(%3%), %4%(%5%)]") % getId() %
@@ -786,11 +1412,11 @@ void CSimpleMultiplexer::processIncoming(boost::shared_ptr<IMessage> msg) throw
 
 //	DBG_INFO(FMT("Received packet from %1% (dest %2%)") % hdr.srcNodeName % hdr.destNodeName);
 
-	if (hdr.autoForward && hdr.destNodeName != "" && hdr.destNodeName != nodeArch->getNodeName()) {
+	if (relay) {
 		// relaying
-		map<ipv4::CLocatorValue, SimpleFib_Entry>::iterator it;
-		it = fib.find(hdr.destIpv4Addr);
-		if (it != fib.end()) {
+		CSimpleFib::CReader fibReader(fib);
+		const CSimpleFib::CRoute * route = fibReader.find(hdr.destIpv4Addr);
+		if (route != NULL) {
 //			DBG_DEBUG(FMT("%1% CSimpleMultiplexer: Relaying message (src %2%, dest %3%, nextHop %4%)...") %
 //				nodeArch->getNodeName() %
 //				hdr->srcIpv4Addr.toStr() %
@@ -799,19 +1425,19 @@ void CSimpleMultiplexer::processIncoming(boost::shared_ptr<IMessage> msg) throw
 
 			mbuf->flushVisitedProcessors(); // reset loop detection
 
-			mbuf->setProperty(IMessage::p_destLoc, new ipv4::CLocatorValue(hdr.destIpv4Addr));
-			mbuf->setProperty(IMessage::p_srcLoc, new ipv4::CLocatorValue(hdr.srcIpv4Addr));
+			mbuf->setProperty(IMessage::p_destLoc, boost::make_shared<ipv4::CLocatorValue>(hdr.destIpv4Addr));
+			mbuf->setProperty(IMessage::p_srcLoc, boost::make_shared<ipv4::CLocatorValue>(hdr.srcIpv4Addr));
 
-			if (it->second.nextHopLoc.isValid())
-				mbuf->setProperty(IMessage::p_nextHopLoc, new ipv4::CLocatorValue(it->second.nextHopLoc));
+			if (route->nextHopLoc.isValid())
+				mbuf->setProperty(IMessage::p_nextHopLoc, boost::make_shared<ipv4::CLocatorValue>(route->nextHopLoc));
 
 			mbuf->setType(IMessage::t_outgoing);
 			mbuf->setFrom(this);
-			mbuf->setTo(it->second.netAdapt);
+			mbuf->setTo(route->netAdapt);
 			sendMessage(mbuf);
 
 			// Update the timestamp for this FIB entry
-			updateTimeStamp(hdr.destIpv4Addr);
+			route->touch(nodeArch->getSysTime());
 
 		} else {
 			DBG_ERROR(FMT("%1% CSimpleMultiplexer: Could not relay message (src %2% [%4%], dest %3% [%5%]), discarding: no entry in FIB") %
@@ -825,7 +1451,7 @@ void CSimpleMultiplexer::processIncoming(boost::shared_ptr<IMessage> msg) throw
 
 	} else {
 		// local delivery
-		mbuf->remove_front(hdr.calcSize());
+		mbuf->remove_front(hdrSize);
 
 		// determine Netlet name
 		map<nena::hash_t, INetlet*>::iterator it = hashedNetlets.find(hdr.netletHash);
@@ -867,22 +1493,13 @@ void CSimpleMultiplexer::processIncoming(boost::shared_ptr<IMessage> msg) throw
 		}
 
 		if (hdr.serviceHash != 0) {
-			std::string serviceId;
-			list<std::string> services;
-			netletSelector->getRegisteredAppServices(services);
-			list<std::string>::const_iterator it;
-			for (it = services.begin(); it != services.end(); it++)
-			{
-				if (nena::hash_string(*it) == hdr.serviceHash) {
-					serviceId = *it;
-					mbuf->setProperty(IMessage::p_serviceId, new CStringValue(serviceId));
-					break;
-				}
-			}
-
-			if (serviceId.empty())
+			shared_ptr<CStringValue> serviceIdValue = netletSelector->lookupAppServiceHash(hdr.serviceHash);
+			if (serviceIdValue == NULL)
 				throw EUnhandledMessage((FMT("%1%: Service hash could not be resolved") % getId()).str());
 
+			std::string serviceId = serviceIdValue->value();
+			mbuf->setProperty(IMessage::p_serviceId, serviceIdValue);
+
 			if (mbuf->getFlowState() == NULL) {
 				CFlowState::FlowId flowId = netletSelector->lookupAppService(serviceId);
 				if (flowId == 0)
@@ -898,10 +1515,9 @@ void CSimpleMultiplexer::processIncoming(boost::shared_ptr<IMessage> msg) throw
 //							nodeArch->getNodeName() % childfs->getFlowId());
 
 				} else {
-					childfs = nodeArch->createFlowState(NULL);
+					childfs = nodeArch->createFlowState(NULL, serviceId);
 					childfs->setLocalId(nodeArch->getNodeName());
 					childfs->setRemoteId(hdr.srcNodeName);
-					childfs->setServiceId(serviceId);
 					childfs->setRemoteFlowId(hdr.srcFlowHash);
 					fs->addChildFlowState(childfs);
 
@@ -926,9 +1542,9 @@ void CSimpleMultiplexer::processIncoming(boost::shared_ptr<IMessage> msg) throw
 
 		}
 
-		mbuf->setProperty(IMessage::p_destLoc, new ipv4::CLocatorValue(hdr.destIpv4Addr));
-		mbuf->setProperty(IMessage::p_srcLoc, new ipv4::CLocatorValue(hdr.srcIpv4Addr));
-		mbuf->setProperty(IMessage::p_netletId, new CStringValue(it->second->getMetaData()->getId()));
+		mbuf->setProperty(IMessage::p_destLoc, boost::make_shared<ipv4::CLocatorValue>(hdr.destIpv4Addr));
+		mbuf->setProperty(IMessage::p_srcLoc, boost::make_shared<ipv4::CLocatorValue>(hdr.srcIpv4Addr));
+		mbuf->setProperty(IMessage::p_netletId, boost::make_shared<CStringValue>(it->second->getMetaData()->getId()));
 		mbuf->setFrom(this);
 		mbuf->setTo((IMessageProcessor*) it->second);
 		sendMessage(mbuf);
@@ -962,9 +1578,15 @@ void CSimpleMultiplexer::refreshNetlets()
  */
 void CSimpleMultiplexer::dbgPrintFib()
 {
+	SimpleFib routes;
+	{
+		CSimpleFib::CReader fibReader(fib);
+		fibReader.getAll(routes);
+	}
+
 	DBG_INFO(FMT("=== FIB for %1% %2%") % nodeArch->getNodeName() % getMetaData()->getArchName());
 	map<ipv4::CLocatorValue, SimpleFib_Entry>::iterator it;
-	for (it = fib.begin(); it != fib.end(); it++) {
+	for (it = routes.begin(); it != routes.end(); it++) {
 		assert(it->second.netAdapt != NULL);
 
 		shared_ptr<CMorphableValue> mv;
@@ -982,7 +1604,7 @@ void CSimpleMultiplexer::dbgPrintFib()
 	}
 }
 
-SimpleFib & CSimpleMultiplexer::getFib()
+CSimpleFib & CSimpleMultiplexer::getFib()
 {
 	return fib;
 }
@@ -994,11 +1616,7 @@ void CSimpleMultiplexer::addFibEntry(ipv4::CLocatorValue dest, ipv4::CLocatorVal
 {
 	assert(dest != localAddr);
 
-	map<ipv4::CLocatorValue, SimpleFib_Entry>::const_iterator it;
-	it = fib.find(dest);
-
-	if(it == fib.end())
-		fib[dest] = SimpleFib_Entry(dest, next, na, hops, nodeArch->getSysTime());
+	fib.add(SimpleFib_Entry(dest, next, na, hops, nodeArch->getSysTime()), false);
 }
 
 /**
@@ -1009,7 +1627,7 @@ void CSimpleMultiplexer::addFibEntry(const SimpleFib_Entry& entry)
 	assert(entry.destLoc != localAddr);
 	assert(entry.destLoc.isValid());
 
-	fib[entry.destLoc] = entry;
+	fib.add(entry, true);
 }
 
 /**
@@ -1017,11 +1635,7 @@ void CSimpleMultiplexer::addFibEntry(const SimpleFib_Entry& entry)
  */
 void CSimpleMultiplexer::delFibEntry(ipv4::CLocatorValue dest)
 {
-	map<ipv4::CLocatorValue, SimpleFib_Entry>::const_iterator it;
-	it = fib.find(dest);
-
-	if(it != fib.end())
-		fib.erase(dest);
+	fib.remove(dest);
 }
 
 /**
@@ -1037,11 +1651,11 @@ void CSimpleMultiplexer::delFib()
  */
 void CSimpleMultiplexer::updateTimeStamp(ipv4::CLocatorValue dest)
 {
-	map<ipv4::CLocatorValue, SimpleFib_Entry>::const_iterator it;
-	it = fib.find(dest);
+	CSimpleFib::CReader fibReader(fib);
+	const CSimpleFib::CRoute * route = fibReader.find(dest);
 
-	if(it != fib.end())
-		fib[dest].timeStamp = nodeArch->getSysTime();
+	if (route != NULL)
+		route->touch(nodeArch->getSysTime());
 }
 
 /**
@@ -1049,11 +1663,11 @@ void CSimpleMultiplexer::updateTimeStamp(ipv4::CLocatorValue dest)
  */
 double CSimpleMultiplexer::getTimeStamp(ipv4::CLocatorValue dest)
 {
-	map<ipv4::CLocatorValue, SimpleFib_Entry>::const_iterator it;
-	it = fib.find(dest);
+	CSimpleFib::CReader fibReader(fib);
+	const CSimpleFib::CRoute * route = fibReader.find(dest);
 
-	if(it != fib.end())
-		return fib[dest].timeStamp;
+	if (route != NULL)
+		return route->getTimeStamp();
 	else
 		return 0;
 }
@@ -1072,6 +1686,11 @@ CSimpleNameAddrMapper* CSimpleMultiplexer::getNameAddrMapper() const
 	return nameAddrMapper;
 }
 
+CNodeIdTable& CSimpleMultiplexer::getNodeIds()
+{
+	return nodeIds;
+}
+
 string CSimpleMultiplexer::getStats ()
 {
 //	xml_document stats;
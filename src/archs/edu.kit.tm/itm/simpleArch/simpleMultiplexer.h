@@ -25,6 +25,8 @@
 #include "nameAddrMapper.h"
 #include "messageBuffer.h"
 #include "netAdapt.h"
+#include "atomics.h"
+#include "epoch.h"
 
 // yes, we're based on IPv4
 #include "archdep/ipv4.h"
@@ -32,6 +34,9 @@
 #include <sys/types.h>
 #include <set>
 
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
+
 class INetlet;
 class CNetletSelector;
 
@@ -74,6 +79,216 @@ public:
 
 typedef std::map<ipv4::CLocatorValue, SimpleFib_Entry> SimpleFib;	///< locator -> network access
 
+/// minimum number of slots of the FIB hash table (power of two)
+#define SIMPLEMULTIPLEXER_FIB_SIZE	64
+
+/**
+ * @brief	Forwarding information base, optimized for lookups
+ *
+ * 			The routes are kept in an open addressing hash table, writers
+ * 			are serialized by a mutex. Routes to new destinations are added
+ * 			in place: the slot is filled first and then marked as used with
+ * 			a release store, so a concurrent lookup either misses it or sees
+ * 			it complete. Replacing or removing routes and growing the table
+ * 			builds a new table that is swapped in; a whole RIX is merged with
+ * 			a single copy. Forwarding neither locks nor allocates, it looks
+ * 			up inside a read section (CReader) and replaced tables are freed
+ * 			through nena::CEpoch. Timestamps are refreshed in place with
+ * 			relaxed atomic stores. A refresh that hits a table while it is
+ * 			being replaced may get lost.
+ */
+class CSimpleFib
+{
+public:
+	class CRoute
+	{
+	private:
+		mutable nena::atomic<uint64_t> timeStampBits;	///< system time as raw double
+
+	public:
+		ipv4::CLocatorValue destLoc;
+		ipv4::CLocatorValue nextHopLoc;
+		INetAdapt* netAdapt;
+		int hops;
+		nena::atomic<bool> used;	///< set last, with release semantics
+
+		CRoute() : timeStampBits(0), netAdapt(NULL), hops(-1), used(false) {};
+
+		void set(const SimpleFib_Entry& entry);
+		SimpleFib_Entry get() const;
+
+		double getTimeStamp() const;
+
+		/// refresh the timestamp (relaxed, no lock)
+		void touch(double now) const;
+	};
+
+private:
+	class CTable
+	{
+	public:
+		std::size_t mask;
+		std::size_t count;
+		CRoute * slots;
+
+		CTable(std::size_t minCount);
+		~CTable();
+
+		const CRoute * find(const ipv4::CLocatorValue& dest) const;
+		void insert(const SimpleFib_Entry& entry);
+
+		/// true if another route fits without exceeding a load factor of 1/2
+		inline bool hasRoom() const
+		{
+			return 2 * (count + 1) <= mask + 1;
+		}
+
+		CTable * copy(std::size_t minCount) const;
+	};
+
+	boost::mutex mutex;						///< serializes writers
+	nena::atomic<CTable *> table;
+
+public:
+	/**
+	 * @brief	Read section. Routes returned by find() are valid until the
+	 * 			reader is destroyed.
+	 */
+	class CReader
+	{
+	private:
+		nena::CEpoch::CGuard guard;
+		const CTable * table;
+
+		CReader(const CReader&);
+		CReader& operator=(const CReader&);
+
+	public:
+		CReader(CSimpleFib& fib);
+
+		/// returns the route to a locator or NULL
+		const CRoute * find(const ipv4::CLocatorValue& dest) const;
+
+		/// appends all routes
+		void getAll(SimpleFib& fib) const;
+	};
+
+	CSimpleFib();
+	virtual ~CSimpleFib();
+
+	/**
+	 * @brief	Adds a route, an existing one is only replaced if replace is true
+	 */
+	void add(const SimpleFib_Entry& entry, bool replace);
+
+	/**
+	 * @brief	Adds routes to unknown destinations and replaces known ones
+	 * 			if the new route has less hops (their timestamp is set to now)
+	 *
+	 * @returns	Number of added routes
+	 */
+	unsigned int merge(const std::list<SimpleFib_Entry>& entries, double now);
+
+	/**
+	 * @brief	Removes a route
+	 */
+	void remove(const ipv4::CLocatorValue& dest);
+
+	/**
+	 * @brief	Removes all routes
+	 */
+	void clear();
+};
+
+/* ========================================================================= */
+
+/**
+ * @brief	Intern table for the node IDs of the compact multiplexer header
+ *
+ * 			A node ID is the NENA hash of the node name. The routing Netlet
+ * 			announces our own name and the names of the nodes we heard from
+ * 			ourselves (their RIX or their packets) in its RIX messages, so
+ * 			each node learns the names behind the IDs of the nodes up to two
+ * 			hops away and of the nodes it talks to. Names learnt from other
+ * 			announcements are not announced again, so the name of a node that
+ * 			is gone cannot circulate and expires everywhere after
+ * 			SIMPLEMULTIPLEXER_NAME_TIMEOUT. IDs shared by two names are marked
+ * 			as conflicting and are not used. Since the RIX of a neighbour lists
+ * 			the names it knows, it also tells us whether the neighbour can
+ * 			resolve our own ID.
+ */
+class CNodeIdTable
+{
+public:
+	/**
+	 * @brief	Where a name came from
+	 */
+	enum Source
+	{
+		s_announced,	///< RIX of a neighbour
+		s_heard,		///< the node itself, by its RIX or a packet
+		s_local			///< our own name, never expires
+	};
+
+	class Entry
+	{
+	public:
+		boost::shared_ptr<CStringValue> name;	///< shared as p_srcId/p_destId property
+		double learnt;		///< system time the name was last announced or heard
+		double heard;		///< system time we last heard from the node itself, -1 if never
+		double confirmed;	///< system time the node last announced our name, -1 if it did not
+		bool local;			///< our own name
+		bool conflict;		///< another name with the same ID was seen
+
+		Entry() : learnt(0), heard(-1), confirmed(-1), local(false), conflict(false) {};
+	};
+
+private:
+	mutable boost::shared_mutex mutex;
+	std::map<uint32_t, Entry> entries;
+
+public:
+	/**
+	 * @brief	Returns the node ID of a name (0 is reserved for "no node")
+	 */
+	static uint32_t toId(const std::string& name);
+
+	/**
+	 * @brief	Adds or refreshes a name, returns its ID or 0 on conflicts
+	 */
+	uint32_t intern(const std::string& name, double now, Source source = s_announced);
+
+	/**
+	 * @brief	Returns the name of an ID, NULL if unknown or conflicting
+	 */
+	boost::shared_ptr<CStringValue> lookup(uint32_t id) const;
+
+	/**
+	 * @brief	Returns the system time a name was learnt, -1 if unknown or conflicting
+	 */
+	double learntAt(const std::string& name) const;
+
+	/**
+	 * @brief	Appends the names to announce, at most max
+	 */
+	void getNames(std::list<std::string>& names, double now, std::size_t max) const;
+
+	/**
+	 * @brief	Removes names neither announced nor heard for a while
+	 */
+	void expire(double now);
+
+	/**
+	 * @brief	Records whether the last RIX of a node announced our name
+	 */
+	void setKnowsLocalName(const std::string& name, bool knows, double now);
+
+	/**
+	 * @brief	Returns true if a recent RIX of the node announced our name
+	 */
+	bool knowsLocalName(const std::string& name, double now) const;
+};
+
 /* ========================================================================= */
 
 /**
@@ -92,12 +307,21 @@ public:
 	 */
 	virtual boost::shared_ptr<CMessageBuffer> serialize() const
 	{
-		std::size_t s = sizeof(uint32_t);
-		boost::shared_ptr<CMessageBuffer> mbuf(new CMessageBuffer(s));
-		mbuf->push_ulong((uint32_t) serviceHash);
+		boost::shared_ptr<CMessageBuffer> mbuf(new CMessageBuffer(getSerializedSize()));
+		serializeInPlace(*mbuf);
 		return mbuf;
 	}
 
+	virtual std::size_t getSerializedSize() const
+	{
+		return sizeof(uint32_t);
+	}
+
+	virtual void serializeInPlace(CMessageBuffer& mbuf) const
+	{
+		mbuf.push_ulong((uint32_t) serviceHash);
+	}
+
 	/**
 	 * @brief De-serialize all relevant data from a byte buffer. Remember to do Little/Big Endian conversion.
 	 *
@@ -258,12 +482,17 @@ protected:
 
 	CNetletSelector* netletSelector;
 
-	SimpleFib fib; 			///< Forwarding information base; TODO: access to this should be thread-safe...
+	CSimpleFib fib; 		///< Forwarding information base
 
 	bool reactiveRouting;	///< true, if we have a reactive routing protocol
 
 	ipv4::CLocatorValue localAddr;	///< transitional
 
+	bool compactHeader;		///< use the compact header towards nodes that announced their name
+	CNodeIdTable nodeIds;	///< node names learnt by the routing Netlet
+	uint32_t localNodeId;
+	boost::shared_ptr<CStringValue> localNodeName;
+
 public:
 	CSimpleMultiplexer(IMultiplexerMetaData *metaData, CNena *nodeA, IMessageScheduler *sched);
 	virtual ~CSimpleMultiplexer();
@@ -307,7 +536,7 @@ public:
 
 	// own
 
-	virtual SimpleFib& getFib();
+	virtual CSimpleFib& getFib();
 	virtual void dbgPrintFib();
 
 	/**
@@ -347,6 +576,8 @@ public:
 
 	virtual CSimpleNameAddrMapper* getNameAddrMapper() const;	///< return name/addr mapper
 
+	virtual CNodeIdTable& getNodeIds();	///< return node ID intern table
+
 	/**
 	 * @brief return an xml string containing stats
 	 */
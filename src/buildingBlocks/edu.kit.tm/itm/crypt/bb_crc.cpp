@@ -25,6 +25,9 @@ Bb_CRC::Bb_CRC(CNena *nodeArch, IMessageScheduler *sched, IComposableNetlet *net
 	IBuildingBlock(nodeArch, sched, netlet, id)
 {
 	className += "::Bb_CRC";
+
+	// no state between messages, may be called inline
+	setReentrant(true);
 }
 
 Bb_CRC::~Bb_CRC()
@@ -22,6 +22,9 @@ Bb_Frag::Bb_Frag(CNena *nodeArch, IMessageScheduler *sched, IComposableNetlet *n
 	IBuildingBlock(nodeArch, sched, netlet, id)
 {
 	className += "::Bb_Frag";
+
+	// no state between messages, may be called inline
+	setReentrant(true);
 }
 
 Bb_Frag::~Bb_Frag()
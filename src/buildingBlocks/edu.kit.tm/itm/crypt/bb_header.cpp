@@ -53,6 +53,9 @@ Bb_Header::Bb_Header(CNena *nodeArch, IMessageScheduler *sched, IComposableNetle
 	IBuildingBlock(nodeArch, sched, netlet, id)
 {
 	className += "::Bb_Header";
+
+	// no state between messages, may be called inline
+	setReentrant(true);
 }
 
 Bb_Header::~Bb_Header()
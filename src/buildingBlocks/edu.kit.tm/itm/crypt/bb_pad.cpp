@@ -23,6 +23,9 @@ Bb_Pad::Bb_Pad(CNena *nodeArch, IMessageScheduler *sched, IComposableNetlet *net
 	IBuildingBlock(nodeArch, sched, netlet, id)
 {
 	className += "::Bb_Pad";
+
+	// no state between messages, may be called inline
+	setReentrant(true);
 }
 
 Bb_Pad::~Bb_Pad()
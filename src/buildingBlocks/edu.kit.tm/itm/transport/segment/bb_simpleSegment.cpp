@@ -81,7 +81,7 @@ void Bb_SimpleSegment::processOutgoing(boost::shared_ptr<IMessage> msg) throw (E
 	pkt->setTo(getNext());
 
 	if (endOfStream)
-		pkt->getProperty<CBoolValue>(IMessage::p_endOfStream)->set(false);
+		pkt->setProperty(IMessage::p_endOfStream, new CBoolValue(false));
 
 	while (pkt->size() > SIMPLESEGMENT_SIZE) {
 		shared_ptr<CMessageBuffer> newpkt = pkt->clone();
@@ -94,7 +94,7 @@ void Bb_SimpleSegment::processOutgoing(boost::shared_ptr<IMessage> msg) throw (E
 	}
 
 	if (endOfStream)
-		pkt->getProperty<CBoolValue>(IMessage::p_endOfStream)->set(true);
+		pkt->setProperty(IMessage::p_endOfStream, new CBoolValue(true));
 
 	if (pkt->size() > 0 || endOfStream) {
 		sendMessage(pkt);
@@ -0,0 +1,190 @@
+/** @file
+ * epoch.cpp
+ *
+ * @brief Epoch based reclamation for lock-free readers
+ *
+ * (c) 2008-2012 Institut fuer Telematik, KIT, Germany
+ */
+
+#include "epoch.h"
+#include "atomics.h"
+
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/tss.hpp>
+
+namespace nena
+{
+
+namespace
+{
+
+/**
+ * @brief	Reader state of one thread
+ *
+ * 			Records are never freed. A record whose thread exited is handed
+ * 			to the next new thread.
+ */
+class CRecord
+{
+public:
+	char padFront[64];					///< keep the state of neighbouring records in separate cache lines
+	nena::atomic<uint64_t> state;		///< epoch << 1 | 1 inside a guard, 0 outside
+	unsigned int nesting;				///< guards of the owning thread
+	nena::atomic<bool> owned;			///< a thread uses the record
+	CRecord * next;						///< immutable once the record is published
+	char pad[64];
+
+	CRecord() : state(0), nesting(0), owned(true), next(NULL) {}
+};
+
+class CRetired
+{
+public:
+	void * p;
+	CEpoch::deleter_t del;
+	uint64_t epoch;			///< global epoch after p was unlinked
+
+	CRetired(void * p, CEpoch::deleter_t del, uint64_t epoch) :
+			p(p), del(del), epoch(epoch)
+	{}
+};
+
+/**
+ * @brief	Global state, never destroyed since tables owned by static
+ * 			objects may still retire on exit
+ */
+class CGlobal
+{
+public:
+	nena::atomic<uint64_t> epoch;
+	nena::atomic<CRecord *> records;	///< list of all records, only prepended to
+	boost::mutex mutex;					///< protects retired
+	std::vector<CRetired> retired;
+	boost::thread_specific_ptr<CRecord> owner;
+
+	static void release(CRecord * r)
+	{
+		r->owned.store(false, nena::memory_order_release);
+	}
+
+	CGlobal() : epoch(1), owner(&CGlobal::release) {}
+};
+
+/// fast access to the record of the calling thread, owned by global().owner
+__thread CRecord * threadRecord = NULL;
+
+CGlobal & global()
+{
+	static CGlobal * g = new CGlobal();
+	return *g;
+}
+
+CRecord & record()
+{
+	if (threadRecord != NULL)
+		return *threadRecord;
+
+	CGlobal & g = global();
+
+	// take over the record of an exited thread
+	CRecord * r;
+	for (r = g.records.load(nena::memory_order_acquire); r != NULL; r = r->next) {
+		bool expected = false;
+		if (!r->owned.load(nena::memory_order_relaxed) && r->owned.compare_exchange(expected, true))
+			break;
+	}
+
+	if (r == NULL) {
+		r = new CRecord();
+		CRecord * head = g.records.load(nena::memory_order_relaxed);
+		do {
+			r->next = head;
+		} while (!g.records.compare_exchange(head, r, nena::memory_order_release));
+	}
+
+	threadRecord = r;
+	g.owner.reset(r);
+	return *r;
+}
+
+/**
+ * @brief	Advances the global epoch if every thread inside a guard has
+ * 			seen it
+ */
+bool advance(CGlobal & g)
+{
+	uint64_t e = g.epoch.load();
+	for (CRecord * r = g.records.load(nena::memory_order_acquire); r != NULL; r = r->next) {
+		uint64_t s = r->state.load();
+		if ((s & 1) && (s >> 1) != e)
+			return false;
+	}
+
+	return g.epoch.compare_exchange(e, e + 1);
+}
+
+} // anonymous namespace
+
+void CEpoch::enter()
+{
+	CRecord & r = record();
+	if (r.nesting++ > 0)
+		return;
+
+	// the sequentially consistent store orders the announcement before all
+	// loads of the read section
+	r.state.store(global().epoch.load() << 1 | 1);
+}
+
+void CEpoch::leave()
+{
+	CRecord & r = *threadRecord;
+	if (--r.nesting == 0)
+		r.state.store(0, nena::memory_order_release);
+}
+
+void CEpoch::retire(void * p, deleter_t del)
+{
+	CGlobal & g = global();
+	{
+		boost::lock_guard<boost::mutex> lock(g.mutex);
+		g.retired.push_back(CRetired(p, del, g.epoch.load()));
+	}
+
+	reclaim();
+}
+
+void CEpoch::reclaim()
+{
+	CGlobal & g = global();
+	std::vector<CRetired> dead;
+	{
+		boost::lock_guard<boost::mutex> lock(g.mutex);
+		if (g.retired.empty())
+			return;
+
+		// readers are short, so usually nobody keeps us from advancing twice
+		if (advance(g))
+			advance(g);
+
+		uint64_t e = g.epoch.load();
+		std::size_t kept = 0;
+		for (std::size_t i = 0; i < g.retired.size(); i++) {
+			if (e - g.retired[i].epoch >= 2)
+				dead.push_back(g.retired[i]);
+			else
+				g.retired[kept++] = g.retired[i];
+		}
+		g.retired.erase(g.retired.begin() + kept, g.retired.end());
+	}
+
+	// deleters may retire further objects
+	for (std::size_t i = 0; i < dead.size(); i++)
+		dead[i].del(dead[i].p);
+}
+
+}
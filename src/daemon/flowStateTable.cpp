@@ -0,0 +1,158 @@
+/** @file
+ * flowStateTable.cpp
+ *
+ * @brief Concurrent map of flow IDs to flow states
+ *
+ * (c) 2008-2012 Institut fuer Telematik, KIT, Germany
+ */
+
+#include "flowStateTable.h"
+#include "epoch.h"
+
+#include <boost/thread/locks.hpp>
+
+using boost::shared_ptr;
+
+CFlowStateTable::CBuckets::CBuckets(std::size_t size) :
+		mask(size - 1), heads(new nena::atomic<CNode *>[size])
+{
+}
+
+CFlowStateTable::CBuckets::~CBuckets()
+{
+	delete [] heads;
+}
+
+void CFlowStateTable::CBuckets::destroy(void * p)
+{
+	CBuckets * b = static_cast<CBuckets *>(p);
+	for (std::size_t i = 0; i <= b->mask; i++) {
+		CNode * n = b->heads[i].load(nena::memory_order_relaxed);
+		while (n != NULL) {
+			CNode * next = n->next.load(nena::memory_order_relaxed);
+			delete n;
+			n = next;
+		}
+	}
+	delete b;
+}
+
+CFlowStateTable::CShard::CShard() :
+		buckets(new CBuckets(FLOWSTATETABLE_BUCKETS)), size(0)
+{
+}
+
+CFlowStateTable::CShard::~CShard()
+{
+	CBuckets::destroy(buckets.load());
+}
+
+/**
+ * @brief	Doubles the number of buckets. The nodes are copied, since
+ * 			readers may still walk the old chains. Returns the old bucket
+ * 			array, which has to be retired along with its chains.
+ */
+CFlowStateTable::CBuckets * CFlowStateTable::CShard::grow()
+{
+	CBuckets * old = buckets.load(nena::memory_order_relaxed);
+	CBuckets * b = new CBuckets((old->mask + 1) * 2);
+
+	for (std::size_t i = 0; i <= old->mask; i++) {
+		CNode * n = old->heads[i].load(nena::memory_order_relaxed);
+		while (n != NULL) {
+			nena::atomic<CNode *> & head = b->heads[bucket(b, n->id)];
+			head.store(new CNode(n->id, n->state, head.load(nena::memory_order_relaxed)), nena::memory_order_relaxed);
+
+			n = n->next.load(nena::memory_order_relaxed);
+		}
+	}
+
+	buckets.store(b);
+	return old;
+}
+
+void CFlowStateTable::insert(shared_ptr<CFlowState> state)
+{
+	CFlowState::FlowId id = state->getFlowId();
+	CShard & s = shard(id);
+	CNode * replaced;
+	CBuckets * outgrown = NULL;
+
+	{
+		boost::lock_guard<boost::mutex> lock(s.mutex);
+
+		replaced = unlink(s, id);
+
+		CBuckets * b = s.buckets.load(nena::memory_order_relaxed);
+		nena::atomic<CNode *> & head = b->heads[bucket(b, id)];
+		head.store(new CNode(id, state, head.load(nena::memory_order_relaxed)));
+
+		// keep the chains short
+		if (++s.size > 2 * (b->mask + 1))
+			outgrown = s.grow();
+	}
+
+	// outside the lock, freeing may drop the last reference to a flow state
+	if (replaced != NULL)
+		nena::CEpoch::retire(replaced);
+	if (outgrown != NULL)
+		nena::CEpoch::retire(outgrown, &CBuckets::destroy);
+}
+
+/**
+ * @brief	Unlinks the node of an ID, the shard must be locked. Returns the
+ * 			node or NULL if the ID is unknown.
+ */
+CFlowStateTable::CNode * CFlowStateTable::unlink(CShard & s, CFlowState::FlowId id)
+{
+	CBuckets * b = s.buckets.load(nena::memory_order_relaxed);
+	nena::atomic<CNode *> * link = &b->heads[bucket(b, id)];
+
+	CNode * n;
+	while ((n = link->load(nena::memory_order_relaxed)) != NULL) {
+		if (n->id == id) {
+			link->store(n->next.load(nena::memory_order_relaxed));
+			s.size--;
+			return n;
+		}
+
+		link = &n->next;
+	}
+
+	return NULL;
+}
+
+bool CFlowStateTable::erase(CFlowState::FlowId id)
+{
+	CShard & s = shard(id);
+	CNode * n;
+
+	{
+		boost::lock_guard<boost::mutex> lock(s.mutex);
+		n = unlink(s, id);
+	}
+
+	if (n == NULL)
+		return false;
+
+	nena::CEpoch::retire(n);
+	return true;
+}
+
+shared_ptr<CFlowState> CFlowStateTable::find(CFlowState::FlowId id)
+{
+	CShard & s = shard(id);
+	shared_ptr<CFlowState> state;
+
+	nena::CEpoch::CGuard guard;
+
+	CBuckets * b = s.buckets.load();
+	for (CNode * n = b->heads[bucket(b, id)].load(); n != NULL; n = n->next.load()) {
+		if (n->id == id) {
+			state = n->state;
+			break;
+		}
+	}
+
+	return state;
+}
@@ -0,0 +1,101 @@
+/** @file
+ * flowStateTable.h
+ *
+ * @brief Concurrent map of flow IDs to flow states
+ *
+ * (c) 2008-2012 Institut fuer Telematik, KIT, Germany
+ */
+
+#ifndef FLOWSTATETABLE_H_
+#define FLOWSTATETABLE_H_
+
+#include "flowState.h"
+#include "atomics.h"
+
+#include <boost/thread/mutex.hpp>
+
+/// number of independently locked shards (power of two)
+#define FLOWSTATETABLE_SHARDS	16
+
+/// initial number of buckets per shard (power of two)
+#define FLOWSTATETABLE_BUCKETS	64
+
+/**
+ * @brief	Maps flow IDs to flow states
+ *
+ * 			Looked up for every incoming packet, so find() does not lock.
+ * 			The table is split into shards by flow ID. Each shard is a
+ * 			chained hash table whose writers are serialized by a mutex and
+ * 			publish nodes with atomic stores. find() walks the chains inside
+ * 			a nena::CEpoch guard, unlinked nodes and outgrown bucket arrays
+ * 			are handed to nena::CEpoch::retire().
+ */
+class CFlowStateTable
+{
+private:
+	class CNode
+	{
+	public:
+		CFlowState::FlowId id;
+		boost::shared_ptr<CFlowState> state;
+		nena::atomic<CNode *> next;
+
+		CNode(CFlowState::FlowId id, boost::shared_ptr<CFlowState> state, CNode * next) :
+				id(id), state(state), next(next)
+		{}
+	};
+
+	class CBuckets
+	{
+	public:
+		std::size_t mask;
+		nena::atomic<CNode *> * heads;
+
+		CBuckets(std::size_t size);
+		~CBuckets();
+
+		/// deletes the bucket array with all chained nodes
+		static void destroy(void * p);
+	};
+
+	class CShard
+	{
+	public:
+		boost::mutex mutex;						///< serializes writers
+		nena::atomic<CBuckets *> buckets;
+		std::size_t size;						///< number of flow states
+		char pad[64];		///< keep the mutexes of neighbouring shards in separate cache lines
+
+		CShard();
+		~CShard();
+
+		CBuckets * grow();
+	};
+
+	CShard shards[FLOWSTATETABLE_SHARDS];
+
+	/// flow IDs are assigned sequentially, so the low bits spread well
+	inline CShard & shard(CFlowState::FlowId id)
+	{
+		return shards[id & (FLOWSTATETABLE_SHARDS - 1)];
+	}
+
+	static inline std::size_t bucket(const CBuckets * b, CFlowState::FlowId id)
+	{
+		return (id / FLOWSTATETABLE_SHARDS) & b->mask;
+	}
+
+	CNode * unlink(CShard & s, CFlowState::FlowId id);
+
+public:
+	/// add a flow state, replaces a flow state with the same ID
+	void insert(boost::shared_ptr<CFlowState> state);
+
+	/// remove a flow state, returns false if the ID is unknown
+	bool erase(CFlowState::FlowId id);
+
+	/// returns the flow state of an ID or NULL if it is unknown (does not lock)
+	boost::shared_ptr<CFlowState> find(CFlowState::FlowId id);
+};
+
+#endif /* FLOWSTATETABLE_H_ */
@@ -695,7 +695,19 @@ shared_ptr<IBuildingBlock> CLocalRepository::buildingBlockFactory (CNena *nena,
 {
 	if (loaderMap.find(bbclass) == loaderMap.end())
 		throw ENoSuchBuildingBlock(bbclass);
-	return loaderMap[bbclass].instantiateBuildingBlock(nena, sched, netlet, id);
+	shared_ptr<IBuildingBlock> bb = loaderMap[bbclass].instantiateBuildingBlock(nena, sched, netlet, id);
+
+	/// inline calls by the scheduler: block setting before Netlet setting before the block's default
+	if (bb.get() != NULL) {
+		bool reentrant = bb->isReentrant();
+		if (nena->getConfig()->hasParameter(bb->getId(), "reentrant", XMLFile::BOOL, XMLFile::VALUE))
+			nena->getConfig()->getParameter(bb->getId(), "reentrant", reentrant);
+		else if (netlet != NULL && nena->getConfig()->hasParameter(netlet->getId(), "reentrantBuildingBlocks", XMLFile::BOOL, XMLFile::VALUE))
+			nena->getConfig()->getParameter(netlet->getId(), "reentrantBuildingBlocks", reentrant);
+		bb->setReentrant(reentrant);
+	}
+
+	return bb;
 }
 
 INetlet * CLocalRepository::getNetletByName (string name)
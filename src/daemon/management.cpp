@@ -41,6 +41,32 @@ using boost::shared_lock;
 using boost::unique_lock;
 using namespace boost::property_tree;
 
+/**
+ * @brief	Escapes a string for use inside a JSON string literal
+ */
+static string jsonEscape(const string & s)
+{
+	string r;
+	r.reserve(s.size());
+
+	for (string::const_iterator it = s.begin(); it != s.end(); it++) {
+		switch (*it) {
+		case '"': r += "\\\""; break;
+		case '\\': r += "\\\\"; break;
+		case '\n': r += "\\n"; break;
+		case '\r': r += "\\r"; break;
+		case '\t': r += "\\t"; break;
+		default:
+			if (static_cast<unsigned char>(*it) < 0x20)
+				r += (FMT("\\u%1$04x") % static_cast<int>(*it)).str();
+			else
+				r += *it;
+		}
+	}
+
+	return r;
+}
+
 /*
  * TODO: denis: is this private implementation really necessary?
  */
@@ -289,6 +315,61 @@ void Management::processEvent(boost::shared_ptr<IMessage> msg) throw (EUnhandled
 		reply_msg->setFlowState(msg->getFlowState());
 		sendMessage(reply_msg);
 
+	} else if ((uri == "nena://localhost/stateViewer/schedulers") && (m == IAppConnector::method_get)) {
+		// QnD for stateViewer
+		string reply("{ \"schedulers\": [");
+
+		list<IMessageScheduler *> schedulers;
+		d_func()->sys->getSchedulers(schedulers);
+		list<IMessageScheduler *>::const_iterator it;
+		for (it = schedulers.begin(); it != schedulers.end(); it++) {
+			reply += " { \"name\": \"" + jsonEscape((*it)->getPrivateName()) + "\", \"processors\": [";
+
+			list<IMessageScheduler::CProcessorStatistics> stats;
+			(*it)->getProcessorStatistics(stats);
+			list<IMessageScheduler::CProcessorStatistics>::const_iterator sit;
+			for (sit = stats.begin(); sit != stats.end(); sit++) {
+				reply += " { \"name\": \"" + jsonEscape(sit->processor) + "\",";
+				reply += (FMT(" \"enqueued\": %1%") % sit->enqueued).str() + ",";
+				reply += (FMT(" \"enqueueRate\": %1%") % sit->enqueueRate).str() + ",";
+				reply += (FMT(" \"queueDepth\": %1%") % sit->queueDepth).str() + ",";
+				reply += (FMT(" \"maxQueueDepth\": %1%") % sit->maxQueueDepth).str() + ",";
+
+				// histograms, bucket i counts durations of 2^i microseconds
+				reply += " \"waitTime\": [";
+				for (size_t i = 0; i < sit->waitTime.size(); i++)
+					reply += (FMT("%1%%2%") % (i > 0 ? ", " : " ") % sit->waitTime[i]).str();
+				reply += " ], \"serviceTime\": [";
+				for (size_t i = 0; i < sit->serviceTime.size(); i++)
+					reply += (FMT("%1%%2%") % (i > 0 ? ", " : " ") % sit->serviceTime[i]).str();
+				reply += " ] },";
+			}
+
+			if (!stats.empty())
+				reply.erase(reply.size()-1, 1);
+
+			// bucket i counts batches of 2^i messages
+			vector<uint64_t> batches;
+			(*it)->getBatchHistogram(batches);
+			reply += " ], \"batchSize\": [";
+			for (size_t i = 0; i < batches.size(); i++)
+				reply += (FMT("%1%%2%") % (i > 0 ? ", " : " ") % batches[i]).str();
+
+			reply += " ] },";
+		}
+
+		if (!schedulers.empty())
+			reply.erase(reply.size()-1, 1);
+
+		reply += " ] }";
+
+		shared_ptr<CMessageBuffer> reply_msg(new CMessageBuffer(buffer_t(reply.c_str())));
+		reply_msg->setFrom(this);
+		reply_msg->setTo(msg->getFrom());
+		reply_msg->setType(IMessage::t_incoming);
+		reply_msg->setFlowState(msg->getFlowState());
+		sendMessage(reply_msg);
+
 	// sillberg://
 	} else if ((uri == "nena://localhost/sillberg/capabilities") && (m == IAppConnector::method_get)) {
 		string cap_template = "{ "
@@ -0,0 +1,205 @@
+/** @file
+ * messagePool.cpp
+ *
+ * @brief Freelist allocator for messages
+ *
+ * (c) 2008-2012 Institut fuer Telematik, KIT, Germany
+ */
+
+#include "messagePool.h"
+
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/tss.hpp>
+
+/// blocks moved between a thread and the depot at once
+#define MESSAGEPOOL_BATCH (MESSAGEPOOL_THREAD_CACHE / 2)
+
+namespace nena
+{
+
+namespace
+{
+
+class CBlock
+{
+public:
+	CBlock * next;
+};
+
+/**
+ * @brief	Batches of free blocks shared by all threads
+ */
+class CDepot
+{
+public:
+	boost::mutex mutex;
+	std::vector<CBlock *> batches[MESSAGEPOOL_CLASSES];	///< each entry is a chain of MESSAGEPOOL_BATCH blocks
+};
+
+/**
+ * @brief	Free blocks of one thread
+ */
+class CThreadCache
+{
+public:
+	CBlock * heads[MESSAGEPOOL_CLASSES];
+	std::size_t counts[MESSAGEPOOL_CLASSES];
+
+	CThreadCache();
+	~CThreadCache();
+};
+
+/// fast access to the cache of the calling thread, owned by caches()
+__thread CThreadCache * threadCache = NULL;
+
+/**
+ * The depot and the owner of the thread caches are never destroyed, since
+ * messages may still be freed by other static destructors.
+ */
+CDepot & depot()
+{
+	static CDepot * d = new CDepot();
+	return *d;
+}
+
+boost::thread_specific_ptr<CThreadCache> & caches()
+{
+	static boost::thread_specific_ptr<CThreadCache> * c = new boost::thread_specific_ptr<CThreadCache>();
+	return *c;
+}
+
+inline CThreadCache & cache()
+{
+	if (threadCache == NULL) {
+		threadCache = new CThreadCache();
+		caches().reset(threadCache);
+	}
+
+	return *threadCache;
+}
+
+inline std::size_t blockSize(std::size_t sizeClass)
+{
+	return (sizeClass + 1) * MESSAGEPOOL_GRANULARITY;
+}
+
+void freeChain(CBlock * b)
+{
+	while (b != NULL) {
+		CBlock * next = b->next;
+		::operator delete(b);
+		b = next;
+	}
+}
+
+/**
+ * @brief	Moves MESSAGEPOOL_BATCH blocks of a thread cache to the depot
+ */
+void release(CThreadCache & tc, std::size_t c)
+{
+	CBlock * first = tc.heads[c];
+	CBlock * last = first;
+	for (std::size_t i = 1; i < MESSAGEPOOL_BATCH; i++)
+		last = last->next;
+
+	tc.heads[c] = last->next;
+	tc.counts[c] -= MESSAGEPOOL_BATCH;
+	last->next = NULL;
+
+	{
+		boost::lock_guard<boost::mutex> lock(depot().mutex);
+		if (depot().batches[c].size() < MESSAGEPOOL_DEPOT_BATCHES) {
+			depot().batches[c].push_back(first);
+			return;
+		}
+	}
+
+	freeChain(first);
+}
+
+/**
+ * @brief	Fetches a batch from the depot, returns false if it is empty
+ */
+bool refill(CThreadCache & tc, std::size_t c)
+{
+	CBlock * batch;
+	{
+		boost::lock_guard<boost::mutex> lock(depot().mutex);
+		if (depot().batches[c].empty())
+			return false;
+
+		batch = depot().batches[c].back();
+		depot().batches[c].pop_back();
+	}
+
+	tc.heads[c] = batch;
+	tc.counts[c] = MESSAGEPOOL_BATCH;
+	return true;
+}
+
+CThreadCache::CThreadCache()
+{
+	for (std::size_t c = 0; c < MESSAGEPOOL_CLASSES; c++) {
+		heads[c] = NULL;
+		counts[c] = 0;
+	}
+}
+
+CThreadCache::~CThreadCache()
+{
+	// hand full batches back to the depot, free the rest
+	for (std::size_t c = 0; c < MESSAGEPOOL_CLASSES; c++) {
+		while (counts[c] >= MESSAGEPOOL_BATCH)
+			release(*this, c);
+
+		freeChain(heads[c]);
+	}
+
+	if (threadCache == this)
+		threadCache = NULL;
+}
+
+} // anonymous namespace
+
+void * CMessagePool::allocate(std::size_t size)
+{
+	if (size == 0 || size > MESSAGEPOOL_CLASSES * MESSAGEPOOL_GRANULARITY)
+		return ::operator new(size);
+
+	std::size_t c = (size - 1) / MESSAGEPOOL_GRANULARITY;
+	CThreadCache & tc = cache();
+
+	if (tc.heads[c] == NULL && !refill(tc, c))
+		return ::operator new(blockSize(c));
+
+	CBlock * b = tc.heads[c];
+	tc.heads[c] = b->next;
+	tc.counts[c]--;
+	return b;
+}
+
+void CMessagePool::deallocate(void * p, std::size_t size)
+{
+	if (p == NULL)
+		return;
+
+	if (size == 0 || size > MESSAGEPOOL_CLASSES * MESSAGEPOOL_GRANULARITY) {
+		::operator delete(p);
+		return;
+	}
+
+	std::size_t c = (size - 1) / MESSAGEPOOL_GRANULARITY;
+	CThreadCache & tc = cache();
+
+	CBlock * b = static_cast<CBlock *>(p);
+	b->next = tc.heads[c];
+	tc.heads[c] = b;
+
+	if (++tc.counts[c] > MESSAGEPOOL_THREAD_CACHE)
+		release(tc, c);
+}
+
+} // namespace nena
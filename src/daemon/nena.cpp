@@ -17,6 +17,7 @@
 #include "debug.h"
 
 #include <list>
+#include <set>
 #include <exception>
 
 #include "boost/algorithm/string/trim.hpp"
@@ -42,7 +43,6 @@ CNena::CNena(ISystemWrapper* sys)
 {
 	management.reset(new Management(sys, this));
 	config.reset(new NenaConfig(getNodeName()));
-	lastFlowId = 0;
 
 	DBG_DEBUG(FMT("\n====== NA Daemon on \"%1%\" started ======\n") % getNodeName());
 }
@@ -289,20 +289,41 @@ shared_ptr<NenaConfig> CNena::getConfig() const
 /**
  * @brief	Create a new flow state object
  */
-boost::shared_ptr<CFlowState> CNena::createFlowState(IMessageProcessor *owner)
+boost::shared_ptr<CFlowState> CNena::createFlowState(IMessageProcessor *owner, const std::string& serviceId)
 {
-	CFlowState::FlowId id = 0;
-	shared_ptr<CFlowState> state;
+	CFlowState::FlowId id;
+	do {
+		id = lastFlowId.fetch_add(1) + 1;
+	} while (id == 0);	// 0 means "no flow"
 
-	{
-		unique_lock<shared_mutex>(flowStateMutex);
-		id = ++lastFlowId;
+	shared_ptr<CFlowState> state(new CFlowState(id, owner));
+	setFlowStateServiceId(state, serviceId);
+	flowStates.insert(state);
+
+	return state;
+}
+
+/**
+ * @brief	Changes the service ID of a flow state and moves it in the
+ * 			index searched by lookupFlowStates()
+ */
+void CNena::setFlowStateServiceId(boost::shared_ptr<CFlowState> flowState, const std::string& serviceId)
+{
+	assert(flowState.get() != NULL);
+
+	unique_lock<shared_mutex> lock(flowStateServicesMutex);
 
-		state = shared_ptr<CFlowState>(new CFlowState(id, owner));
-		flowStates[id] = state;
+	map<string, set<CFlowState::FlowId> >::iterator it = flowStateServices.find(flowState->getServiceId());
+	if (it != flowStateServices.end()) {
+		it->second.erase(flowState->getFlowId());
+		if (it->second.empty())
+			flowStateServices.erase(it);
 	}
 
-	return state;
+	flowState->setServiceId(serviceId);
+
+	if (!serviceId.empty())
+		flowStateServices[serviceId].insert(flowState->getFlowId());
 }
 
 /**
@@ -318,32 +339,39 @@ void CNena::releaseFlowState(boost::shared_ptr<CFlowState> flowState)
 
 	DBG_DEBUG(FMT("NC: releasing flow state %1% (refcount %2%)") % flowState->getFlowId() % flowState.use_count());
 
-	unique_lock<shared_mutex>(flowStateMutex);
-	map<CFlowState::FlowId, shared_ptr<CFlowState> >::iterator it = flowStates.find(flowState->getFlowId());
-	assert(it != flowStates.end());
-	flowStates.erase(it);
+	{
+		unique_lock<shared_mutex> lock(flowStateServicesMutex);
+		map<string, set<CFlowState::FlowId> >::iterator it = flowStateServices.find(flowState->getServiceId());
+		if (it != flowStateServices.end()) {
+			it->second.erase(flowState->getFlowId());
+			if (it->second.empty())
+				flowStateServices.erase(it);
+		}
+	}
+
+	bool found = flowStates.erase(flowState->getFlowId());
+	assert(found);
+	(void) found;
 }
 
 boost::shared_ptr<CFlowState> CNena::getFlowState(CFlowState::FlowId flowId)
 {
-	shared_lock<shared_mutex>(flowStateMutex);
-	map<CFlowState::FlowId, shared_ptr<CFlowState> >::iterator it;
-	it = flowStates.find(flowId);
-	if (it != flowStates.end()) {
-		return it->second;
-	}
-	return boost::shared_ptr<CFlowState>();
+	return flowStates.find(flowId);
 }
 
 void CNena::lookupFlowStates(const std::string& remoteUri, std::list<boost::shared_ptr<CFlowState> >& flowStates)
 {
 	flowStates.clear();
 
-	shared_lock<shared_mutex>(flowStateMutex);
-	map<CFlowState::FlowId, shared_ptr<CFlowState> >::iterator it;
-	for (it = this->flowStates.begin(); it != this->flowStates.end(); it++) {
-		if (it->second->getServiceId() == remoteUri) {
-			flowStates.push_back(it->second);
-		}
+	shared_lock<shared_mutex> lock(flowStateServicesMutex);
+	map<string, set<CFlowState::FlowId> >::const_iterator it = flowStateServices.find(remoteUri);
+	if (it == flowStateServices.end())
+		return;
+
+	set<CFlowState::FlowId>::const_iterator fit;
+	for (fit = it->second.begin(); fit != it->second.end(); fit++) {
+		shared_ptr<CFlowState> state = this->flowStates.find(*fit);
+		if (state != NULL && state->getServiceId() == remoteUri)
+			flowStates.push_back(state);
 	}
 }
@@ -17,11 +17,14 @@
 #include "netletRepository.h"
 #include "appConnector.h"
 #include "flowState.h"
+#include "flowStateTable.h"
+#include "atomics.h"
 #include "systemWrapper.h"
 #include "debug.h"
 #include "nenaconfig.h"
 
 #include <string>
+#include <set>
 
 #include <boost/thread/shared_mutex.hpp>
 #include <boost/scoped_ptr.hpp>
@@ -47,9 +50,11 @@ private:
 	boost::shared_mutex internalServicesMutex;
 	std::map<std::string, IMessageProcessor*> internalServices;		///< Internal NENA services
 
-	boost::shared_mutex flowStateMutex;
-	CFlowState::FlowId lastFlowId;									///< last assigned flow id
-	std::map<CFlowState::FlowId, boost::shared_ptr<CFlowState> > flowStates;
+	nena::atomic<CFlowState::FlowId> lastFlowId;					///< last assigned flow id
+	CFlowStateTable flowStates;
+
+	boost::shared_mutex flowStateServicesMutex;						///< protects flowStateServices
+	std::map<std::string, std::set<CFlowState::FlowId> > flowStateServices;	///< service ID -> flow IDs
 
 public:
 
@@ -184,11 +189,21 @@ public:
 	 */
 	boost::shared_ptr<NenaConfig> getConfig () const;
 
-	boost::shared_ptr<CFlowState> createFlowState(IMessageProcessor *owner);
+	/**
+	 * @brief	Creates a new flow state, optionally with a service ID
+	 */
+	boost::shared_ptr<CFlowState> createFlowState(IMessageProcessor *owner, const std::string& serviceId = std::string());
 	void releaseFlowState(boost::shared_ptr<CFlowState> flowState);
 
 	/**
-	 * @brief	Returns the flow state object of a given FlowId
+	 * @brief	Changes the service ID of a flow state and moves it in the
+	 * 			index searched by lookupFlowStates()
+	 */
+	void setFlowStateServiceId(boost::shared_ptr<CFlowState> flowState, const std::string& serviceId);
+
+	/**
+	 * @brief	Returns the flow state object of a given FlowId. This does not
+	 * 			lock and may be called for every packet.
 	 */
 	boost::shared_ptr<CFlowState> getFlowState(CFlowState::FlowId flowId);
 
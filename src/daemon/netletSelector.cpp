@@ -12,6 +12,7 @@
 #include "netletSelector.h"
 #include "nena.h"
 #include "netAdaptBroker.h"
+#include "epoch.h"
 
 #include "properties.h"
 
@@ -37,6 +38,165 @@ using boost::lexical_cast;
 
 const string selectorId = "internalservice://nena/netletSelector";
 
+/* ========================================================================= */
+
+CServiceHashIndex::Entry CServiceHashIndex::tombstone(0, std::string());
+
+CServiceHashIndex::Entry::Entry(nena::hash_t hash, const std::string& serviceId) :
+		hash(hash), serviceId(new CStringValue(serviceId))
+{
+}
+
+CServiceHashIndex::Table::Table(std::size_t size) :
+		mask(size - 1), used(0), slots(new nena::atomic<Entry *>[size])
+{
+}
+
+CServiceHashIndex::Table::~Table()
+{
+	delete [] slots;
+}
+
+CServiceHashIndex::CServiceHashIndex() :
+		table(new Table(NETLETSELECTOR_SERVICEINDEX_SIZE)), count(0)
+{
+}
+
+CServiceHashIndex::~CServiceHashIndex()
+{
+	Table * t = table.load();
+	for (std::size_t i = 0; i <= t->mask; i++) {
+		Entry * e = t->slots[i].load();
+		if (e != &tombstone)
+			delete e;
+	}
+
+	delete t;
+}
+
+/**
+ * @brief	Returns the slot of a service ID or NULL, the mutex must be held
+ */
+nena::atomic<CServiceHashIndex::Entry *> * CServiceHashIndex::find(Table * t, nena::hash_t hash, const std::string& serviceId)
+{
+	std::size_t i = hash & t->mask;
+
+	Entry * e;
+	while ((e = t->slots[i].load(nena::memory_order_relaxed)) != NULL) {
+		if (e != &tombstone && e->hash == hash && e->serviceId->value() == serviceId)
+			return &t->slots[i];
+
+		i = (i + 1) & t->mask;
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief	Puts an entry into the first free slot or tombstone of its
+ * 			probe sequence
+ */
+void CServiceHashIndex::insert(Table * t, Entry * e)
+{
+	std::size_t i = e->hash & t->mask;
+
+	Entry * s;
+	while ((s = t->slots[i].load(nena::memory_order_relaxed)) != NULL && s != &tombstone)
+		i = (i + 1) & t->mask;
+
+	if (s == NULL)
+		t->used++;
+
+	t->slots[i].store(e, nena::memory_order_release);
+}
+
+/**
+ * @brief	Adds a service ID, nothing happens if it is already there
+ */
+void CServiceHashIndex::add(const std::string& serviceId)
+{
+	nena::hash_t hash = nena::hash_string(serviceId);
+	Table * outgrown = NULL;
+	{
+		boost::lock_guard<boost::mutex> lock(mutex);
+
+		Table * t = table.load(nena::memory_order_relaxed);
+		if (find(t, hash, serviceId) != NULL)
+			return;
+
+		Entry * e = new Entry(hash, serviceId);
+		count++;
+
+		// keep entries and tombstones below 1/2, drop the tombstones on the way
+		if ((t->used + 1) * 2 > t->mask + 1) {
+			std::size_t size = NETLETSELECTOR_SERVICEINDEX_SIZE;
+			while (size < count * 4)
+				size *= 2;
+
+			Table * copy = new Table(size);
+			for (std::size_t i = 0; i <= t->mask; i++) {
+				Entry * o = t->slots[i].load(nena::memory_order_relaxed);
+				if (o != NULL && o != &tombstone)
+					insert(copy, o);
+			}
+			insert(copy, e);
+
+			table.store(copy);
+			outgrown = t;
+
+		} else {
+			insert(t, e);
+
+		}
+	}
+
+	if (outgrown != NULL)
+		nena::CEpoch::retire(outgrown);
+}
+
+/**
+ * @brief	Removes a service ID
+ */
+void CServiceHashIndex::remove(const std::string& serviceId)
+{
+	Entry * e;
+	{
+		boost::lock_guard<boost::mutex> lock(mutex);
+
+		nena::atomic<Entry *> * slot = find(table.load(nena::memory_order_relaxed), nena::hash_string(serviceId), serviceId);
+		if (slot == NULL)
+			return;
+
+		e = slot->exchange(&tombstone);
+		count--;
+	}
+
+	nena::CEpoch::retire(e);
+}
+
+/**
+ * @brief	Returns the registered service ID for a hash, NULL if unknown
+ */
+shared_ptr<CStringValue> CServiceHashIndex::lookup(nena::hash_t hash) const
+{
+	nena::CEpoch::CGuard guard;
+
+	const Table * t = table.load();
+	std::size_t i = hash & t->mask;
+
+	Entry * e;
+	while ((e = t->slots[i].load()) != NULL) {
+		if (e != &tombstone && e->hash == hash)
+			return e->serviceId;
+
+		i = (i + 1) & t->mask;
+	}
+
+	return shared_ptr<CStringValue>();
+}
+
+/* ========================================================================= */
+
 /**
  * @brief Constructor
  */
@@ -307,9 +467,8 @@ void CNetletSelector::registerAppConnector(IAppConnector* appConn)
 
 	shared_ptr<CFlowState> flowState = appConn->getFlowState();
 	if (flowState.get() == NULL) {
-		flowState = nena->createFlowState(appConn);
+		flowState = nena->createFlowState(appConn, appConn->getRemoteURI());
 		flowState->setLocalId(nena->getNodeName());
-		flowState->setServiceId(appConn->getRemoteURI());
 		flowState->setMethod(appConn->getMethod());
 		appConn->setFlowState(flowState);
 
@@ -416,6 +575,7 @@ void CNetletSelector::registerAppService(const std::string& serviceId, IAppConne
 	else
 		DBG_DEBUG(FMT("%1%: registering app service %2%") % getId() % serviceId);
 	services[serviceId] = appConn;
+	serviceHashes.add(serviceId);
 }
 
 /**
@@ -441,6 +601,7 @@ void CNetletSelector::unregisterAppService(const std::string& serviceId, IAppCon
 		}
 
 		services.erase(serviceId);
+		serviceHashes.remove(serviceId);
 
 	} else {
 		DBG_WARNING(FMT("%1%: attempted to unregister unknown app service %2%") % getId() % serviceId);
@@ -478,6 +639,19 @@ CFlowState::FlowId CNetletSelector::lookupAppService(std::string serviceId) cons
 	return 0;
 }
 
+/**
+ * @brief	Resolves the NENA hash of a published service ID. This does
+ * 			not lock and may be called for every incoming packet.
+ *
+ * @param	serviceHash	NENA hash of the service ID
+ *
+ * @returns	Service ID or NULL if no registered service has this hash
+ */
+shared_ptr<CStringValue> CNetletSelector::lookupAppServiceHash(nena::hash_t serviceHash) const
+{
+	return serviceHashes.lookup(serviceHash);
+}
+
 /**
  * @brief	Returns the app connector for the given flow ID.
  */
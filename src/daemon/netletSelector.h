@@ -17,12 +17,14 @@
 #include "properties.h"
 #include "appConnector.h"
 #include "nameAddrMapper.h"
+#include "atomics.h"
 
 #include "xmlNode/xmlNode.h"
 
 #include <map>
 #include <list>
 
+#include <boost/thread/mutex.hpp>
 #include <boost/thread/shared_mutex.hpp>
 #include <pugixml.h>
 #include <exceptions.h>
@@ -34,6 +36,9 @@
 #define EVENT_NETLETSELECTOR_APPSERVICEUNREGISTERED	"event://netletSelector/AppServiceUnregistered"
 #define EVENT_NETLETSELECTOR_APPCONNREADY 			"event://netletSelector/AppConnReady"
 
+/// initial number of slots of the service hash index (power of two)
+#define NETLETSELECTOR_SERVICEINDEX_SIZE			64
+
 /**
  * Sent to a Netlet when a new application connects to NENA. In addition, this
  * is emitted to all listeners.
@@ -48,6 +53,70 @@
 
 class CNena;
 
+/**
+ * @brief	Maps the NENA hash of a published service ID to the service ID
+ *
+ * 			Open addressing table that is read without locks by the
+ * 			multiplexers for every incoming packet. Entries are immutable.
+ * 			Unregistering a service replaces its slot with a tombstone, which
+ * 			a later registration along the same probe sequence reuses. When
+ * 			live entries and tombstones fill half of the table, the live
+ * 			entries are copied into a new table. Writers are serialized by a
+ * 			mutex, removed entries and replaced tables are freed through
+ * 			nena::CEpoch.
+ */
+class CServiceHashIndex
+{
+private:
+	class Entry
+	{
+	public:
+		nena::hash_t hash;
+		boost::shared_ptr<CStringValue> serviceId;	///< shared as p_serviceId property
+
+		Entry(nena::hash_t hash, const std::string& serviceId);
+	};
+
+	class Table
+	{
+	public:
+		std::size_t mask;
+		std::size_t used;					///< entries and tombstones (writers only)
+		nena::atomic<Entry *> * slots;
+
+		Table(std::size_t size);
+		~Table();
+	};
+
+	static Entry tombstone;				///< marks the slot of a removed entry
+
+	boost::mutex mutex;					///< serializes writers
+	nena::atomic<Table *> table;		///< current table
+	std::size_t count;					///< registered services
+
+	nena::atomic<Entry *> * find(Table * t, nena::hash_t hash, const std::string& serviceId);
+	void insert(Table * t, Entry * e);
+
+public:
+	CServiceHashIndex();
+	virtual ~CServiceHashIndex();
+
+	/**
+	 * @brief	Marks a service ID as registered
+	 */
+	void add(const std::string& serviceId);
+
+	/**
+	 * @brief	Marks a service ID as unregistered
+	 */
+	void remove(const std::string& serviceId);
+
+	/**
+	 * @brief	Returns the registered service ID for a hash, NULL if unknown
+	 */
+	boost::shared_ptr<CStringValue> lookup(nena::hash_t hash) const;
+};
+
 /**
  * @brief	Manages application connections and implements Netlet selection
  * 			functionality.
@@ -244,6 +313,7 @@ protected:
 
 	std::map<CFlowState::FlowId, IAppConnector*> appConns;	///< connection id -> connector
 	std::map<std::string, IAppConnector*> services;			///< published application service -> app connector
+	CServiceHashIndex serviceHashes;						///< hash of published application service -> service ID
 	std::list<INameAddrMapper*> nameAddrMappers;			///< list of known name/addr mappers
 
 	std::map<std::string, IAppConnector *> parentAppConns;
@@ -347,6 +417,16 @@ public:
 	 */
 	virtual CFlowState::FlowId lookupAppService(std::string serviceId) const;
 
+	/**
+	 * @brief	Resolves the NENA hash of a published service ID. This does
+	 * 			not lock and may be called for every incoming packet.
+	 *
+	 * @param	serviceHash	NENA hash of the service ID
+	 *
+	 * @returns	Service ID or NULL if no registered service has this hash
+	 */
+	virtual boost::shared_ptr<CStringValue> lookupAppServiceHash(nena::hash_t serviceHash) const;
+
 	/**
 	 * @brief	Returns the app connector for the given flow ID.
 	 */
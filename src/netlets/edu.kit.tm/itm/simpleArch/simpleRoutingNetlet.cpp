@@ -24,6 +24,9 @@ namespace simpleArch {
 using namespace std;
 using boost::shared_ptr;
 
+/// node names per RIX message, our own name included
+#define SIMPLEROUTINGNETLET_MAX_NAMES	64
+
 /* ========================================================================= */
 
 /**
@@ -64,12 +67,18 @@ public:
  * 			that we (the sender) can reach via *another* interface.
  *
  * 			The header format is as follows:
- * 			[A][BBBB][CC][D][BBBB][CC][D]...
+ * 			[A][BBBB][CC][D][BBBB][CC][D]...[EE][F][G...][F][G...]...
  * 			Whereas
  * 			A is the number of list entries (one byte)
  * 			B is the IPv4 address (in network format)
  * 			C is the IP port (in network format)
  *          D is the number of hops (max 255)
+ *          E is the number of announced node names (optional, in network format)
+ *          F is the length of a node name (one byte)
+ *          G is the node name
+ *
+ * 			The node names fill the intern table of the multiplexer's compact
+ * 			header. Older nodes ignore them, and send RIX messages without.
  */
 class CSimpleRoutingNetlet_Header_RIX: public IHeader
 {
@@ -84,6 +93,7 @@ public:
 	};
 
 	list<ForwardingInfo> nodes; // list of nodes that can be reached via us and their hops
+	list<string> names; // our name and the names of nodes we heard from (compact header IDs)
 
 	/**
 	 * @brief	Serialize all relevant data into a byte buffer.
@@ -95,7 +105,13 @@ public:
 		
 		size_t s = sizeof(unsigned char) +
 			(sizeof(uint32_t) + sizeof(ushort) + sizeof(unsigned char)) *
-				nodes.size();
+				nodes.size() +
+			sizeof(ushort);
+
+		list<string>::const_iterator nit;
+		for (nit = names.begin(); nit != names.end(); nit++)
+			s += sizeof(unsigned char) + nit->size();
+
 		shared_ptr<CMessageBuffer> buffer(new CMessageBuffer(s));
 
 		buffer->push_uchar((unsigned char) nodes.size());
@@ -111,6 +127,13 @@ public:
 //			DBG_INFO(FMT("it->loc.getAddr(): %1%, it->loc.getPort(): %2%, it->hops: %3%") % it->loc.getAddr() % it->loc.getPort() % it->hops);
 		}
 
+		buffer->push_ushort(names.size());
+		for (nit = names.begin(); nit != names.end(); nit++) {
+			assert(nit->size() <= 255);
+			buffer->push_uchar((unsigned char) nit->size());
+			buffer->push_string(*nit);
+		}
+
 		return buffer;
 	}
 
@@ -140,6 +163,18 @@ public:
 			nodes.push_back(ForwardingInfo(loc, hops));
 		}
 
+		// node names are missing in RIX messages of older nodes
+		if (buffer->size() >= sizeof(ushort)) {
+			ushort count = buffer->pop_ushort();
+			for (ushort i = 0; i < count && buffer->size() > 0; i++) {
+				unsigned char l = buffer->pop_uchar();
+				if (l > buffer->size())
+					break;
+
+				names.push_back(buffer->pop_string(l));
+			}
+		}
+
 	}
 
 };
@@ -222,7 +257,6 @@ void CSimpleRoutingNetlet::processIncoming(boost::shared_ptr<IMessage> msg) thro
 	INetAdapt* na = pkt->getProperty<CPointerValue<INetAdapt> >(IMessage::p_netAdapt)->value();
 	ipv4::CLocatorValue nextHopLoc = *pkt->getProperty<ipv4::CLocatorValue>(IMessage::p_srcLoc);
 
-	SimpleFib& fib = multiplexer->getFib();
 	CSimpleRoutingNetlet_Header_RIX rix;
 	pkt->pop_header(rix);
 
@@ -238,6 +272,7 @@ void CSimpleRoutingNetlet::processIncoming(boost::shared_ptr<IMessage> msg) thro
 
 	}
 
+	list<SimpleFib_Entry> routes;
 	list<CSimpleRoutingNetlet_Header_RIX::ForwardingInfo>::iterator it;
 	for (it = rix.nodes.begin(); it != rix.nodes.end(); it++) {
 
@@ -250,26 +285,30 @@ void CSimpleRoutingNetlet::processIncoming(boost::shared_ptr<IMessage> msg) thro
 			}
 		}
 
-		if (!isLocalLoc) {
-			SimpleFib::iterator fibit = fib.find(it->loc);
-			if (fibit == fib.end()) {
-				// new entry
-				fib[it->loc] = SimpleFib_Entry(it->loc, nextHopLoc, na, it->hops + 1);
-				DBG_INFO(FMT("Added %1% to FIB") % it->loc.toStr());
-
-			} else {
-				// we already have the entry, so update it if necessary
-				if (it->hops + 1 < fibit->second.hops) {
-					fibit->second.hops = it->hops + 1;
-					fibit->second.netAdapt = na;
-					fibit->second.nextHopLoc = nextHopLoc;
-					fibit->second.timeStamp = nena->getSysTime();
-				}
-			}
-		}
+		if (!isLocalLoc)
+			routes.push_back(SimpleFib_Entry(it->loc, nextHopLoc, na, it->hops + 1));
 
 	}
 
+	// new entries are added, known ones are updated if the new route is shorter
+	unsigned int added = multiplexer->getFib().merge(routes, nena->getSysTime());
+	if (added > 0)
+		DBG_INFO(FMT("Added %1% entries to FIB") % added);
+
+	// only the neighbour's own name is first hand, the others are not passed on
+	string neighbour = pkt->getProperty<CStringValue>(IMessage::p_srcId)->value();
+	bool knowsUs = false;
+	list<string>::const_iterator nit;
+	for (nit = rix.names.begin(); nit != rix.names.end(); nit++) {
+		multiplexer->getNodeIds().intern(*nit, nena->getSysTime(),
+				*nit == neighbour ? CNodeIdTable::s_heard : CNodeIdTable::s_announced);
+		if (*nit == nena->getNodeName())
+			knowsUs = true;
+	}
+
+	// the neighbour can resolve our node ID, so it no longer needs our name in each packet
+	multiplexer->getNodeIds().setKnowsLocalName(neighbour, knowsUs, nena->getSysTime());
+
 	multiplexer->dbgPrintFib();
 }
 
@@ -289,6 +328,9 @@ void CSimpleRoutingNetlet::handleTimeout()
 	// get a list with all net adapts we could use
 	list<INetAdapt*>& nas = nena->getNetAdaptBroker()->getNetAdapts(getMetaData()->getArchName());
 
+	// forget the names of nodes nobody announced for a while
+	multiplexer->getNodeIds().expire(nena->getSysTime());
+
 //	DBG_DEBUG(FMT("CSimpleRoutingNetlet: found %1% NAs") % nas.size());
 
 	// send an RIX message over all those netAdapts
@@ -301,7 +343,12 @@ void CSimpleRoutingNetlet::handleTimeout()
 		CSimpleRoutingNetlet_Header_RIX rix;
 		rix.nodes.push_back(CSimpleRoutingNetlet_Header_RIX::ForwardingInfo(myloc, 0)); // we are always reachable
 
-		SimpleFib& fib = multiplexer->getFib();
+		SimpleFib fib;
+		{
+			CSimpleFib::CReader fibReader(multiplexer->getFib());
+			fibReader.getAll(fib);
+		}
+
 		SimpleFib::const_iterator fib_it;
 		for (fib_it = fib.begin(); fib_it != fib.end(); fib_it++) {
 //			if (fib_it->second.netAdapt != *nas_it)
@@ -309,6 +356,9 @@ void CSimpleRoutingNetlet::handleTimeout()
 
 		}
 
+		// our own name is always in there
+		multiplexer->getNodeIds().getNames(rix.names, nena->getSysTime(), SIMPLEROUTINGNETLET_MAX_NAMES);
+
 		shared_ptr<CMessageBuffer> pkt(new CMessageBuffer(this, next, IMessage::t_outgoing));
 		pkt->setProperty(IMessage::p_srcId, new CStringValue(nena->getNodeName()));
 		pkt->setProperty(IMessage::p_srcLoc, new ipv4::CLocatorValue(myloc)); // not necessary, but we already have it
@@ -320,6 +370,9 @@ void CSimpleRoutingNetlet::handleTimeout()
 		sendMessage(pkt);
 	}
 
+	// free what was retired by the last writes, in case no further ones come
+	nena::CEpoch::reclaim();
+
 	// next RIX cycle in 2 seconds // TODO: add parameter/option for this?
 	scheduler->setTimer(new CSimpleRoutingNetlet_Timeout(2.0 + 2 * nena->getSys()->random(), this));
 }
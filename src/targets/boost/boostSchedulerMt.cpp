@@ -2,6 +2,8 @@
 #include "systemBoost.h"
 #include "messages.h"
 #include "debug.h"
+#include "cpuAffinity.h"
+#include "schedulerRegistry.h"
 
 #include "nena.h"
 
@@ -10,10 +12,20 @@
 #include <list>
 #include <exception>
 #include <string>
+#include <cstdlib>
 
 #define NENA_MESSAGE_TRACE_FILE_SEND "nena-messages-send.log"
 #define NENA_MESSAGE_TRACE_FILE_RECV "nena-messages-recv.log"
 
+/// milliseconds an idle worker sleeps before looking for work to steal again
+#define BOOSTSCHEDULER_WS_IDLE_TIMEOUT 10
+
+/// upper limit for batchSize
+#define BOOSTSCHEDULER_MAX_BATCH 65536
+
+/// upper limit for directCallDepth, every level costs stack space
+#define BOOSTSCHEDULER_MAX_DIRECT_CALL_DEPTH 64
+
 using boost::asio::deadline_timer;
 using boost::mutex;
 using boost::shared_mutex;
@@ -102,12 +114,194 @@ bool operator!= (CSyncMessageQueue & lhs, CSyncMessageQueue & rhs)
 
 /*****************************************************************************/
 
-CBoostSchedulerMT::CBoostSchedulerMT (CNena * na, boost::shared_ptr<boost::asio::io_service> ios, int nthreads) :
+CMpscMessageQueue::CMpscMessageQueue () :
+	head(&stub),
+	tail(&stub),
+	count(0)
+{}
+
+CMpscMessageQueue::~CMpscMessageQueue ()
+{
+	// release the self references of all remaining messages
+	while (pop () != NULL);
+}
+
+void CMpscMessageQueue::pushLink (CMessageLink * link)
+{
+	link->next.store (NULL, nena::memory_order_relaxed);
+	CMessageLink * prev = head.exchange (link, nena::memory_order_acq_rel);
+	prev->next.store (link, nena::memory_order_release);
+}
+
+shared_ptr<IMessage> CMpscMessageQueue::pop ()
+{
+	shared_ptr<IMessage> ret;
+
+	CMessageLink * t = tail;
+	CMessageLink * next = t->next.load (nena::memory_order_acquire);
+
+	if (t == &stub) {
+		if (next == NULL)
+			return ret;
+
+		tail = next;
+		t = next;
+		next = next->next.load (nena::memory_order_acquire);
+	}
+
+	if (next == NULL) {
+		if (t != head.load (nena::memory_order_acquire))
+			return ret; // a producer has not linked its message yet
+
+		// t is the last message, put the stub behind it so we can take it
+		pushLink (&stub);
+		next = t->next.load (nena::memory_order_acquire);
+		if (next == NULL)
+			return ret;
+	}
+
+	tail = next;
+	ret.swap (t->self);
+	count.fetch_sub (1);
+
+	return ret;
+}
+
+void CMpscMessageQueue::push (shared_ptr<IMessage> msg)
+{
+	CMessageLink * link = &msg->queueLink;
+	assert(link->self == NULL); // already queued somewhere else
+
+	link->self = msg;
+	count.fetch_add (1);
+	pushLink (link);
+}
+
+bool CMpscMessageQueue::empty () const
+{
+	return count.load () == 0;
+}
+
+size_t CMpscMessageQueue::size () const
+{
+	return count.load ();
+}
+
+/*****************************************************************************/
+
+bool CBoostSchedulerMT::Options::set (const std::string & key, const std::string & value)
+{
+	if (key == "schedulerMode") {
+		if (value == "roundRobin")
+			mode = m_roundRobin;
+		else if (value == "workStealing")
+			mode = m_workStealing;
+		else
+			return false;
+
+	} else if (key == "messageQueue") {
+		if (value == "locked")
+			queueType = q_locked;
+		else if (value == "lockFree")
+			queueType = q_lockFree;
+		else
+			return false;
+
+	} else if (key == "batchSize") {
+		char * end = NULL;
+		unsigned long n = strtoul(value.c_str(), &end, 10);
+		if (end == value.c_str() || *end != '\0' || n == 0 || n > BOOSTSCHEDULER_MAX_BATCH)
+			return false;
+
+		batchSize = n;
+
+	} else if (key == "cpus") {
+		vector<int> list;
+		if (value.empty())
+			cpus.clear();
+		else if (CCpuAffinity::parseCpuList(value, list))
+			cpus = list;
+		else
+			return false;
+
+	} else if (key == "numaNode") {
+		char * end = NULL;
+		long node = strtol(value.c_str(), &end, 10);
+		if (end == value.c_str() || *end != '\0' || node < -1)
+			return false;
+
+		numaNode = node;
+
+	} else if (key == "directCallDepth") {
+		char * end = NULL;
+		unsigned long n = strtoul(value.c_str(), &end, 10);
+		if (end == value.c_str() || *end != '\0' || n > BOOSTSCHEDULER_MAX_DIRECT_CALL_DEPTH)
+			return false;
+
+		directCallDepth = n;
+
+	} else if (key == "priorities") {
+		if (value == "none")
+			priorities = pr_none;
+		else if (value == "strict")
+			priorities = pr_strict;
+		else if (value == "weighted")
+			priorities = pr_weighted;
+		else
+			return false;
+
+	} else if (key == "priorityWeight") {
+		char * end = NULL;
+		unsigned long n = strtoul(value.c_str(), &end, 10);
+		if (end == value.c_str() || *end != '\0' || n == 0)
+			return false;
+
+		priorityWeight = n;
+
+	} else if (key == "telemetry") {
+		if (value == "on")
+			telemetry = true;
+		else if (value == "off")
+			telemetry = false;
+		else
+			return false;
+
+	} else if (key == "timerBackend") {
+		if (value == "asio")
+			timerBackend = t_asio;
+		else if (value == "wheel")
+			timerBackend = t_wheel;
+		else
+			return false;
+
+	} else if (key == "timerTick") {
+		// milliseconds
+		char * end = NULL;
+		double tick = strtod(value.c_str(), &end);
+		if (end == value.c_str() || *end != '\0' || tick <= 0)
+			return false;
+
+		timerTick = tick / 1000;
+
+	} else {
+		return false;
+
+	}
+
+	return true;
+}
+
+/*****************************************************************************/
+
+CBoostSchedulerMT::CBoostSchedulerMT (CNena * na, boost::shared_ptr<boost::asio::io_service> ios, int nthreads, const Options & options) :
 	IMessageScheduler(NULL),
 	nena (na),
+	options (options),
 	io_service(ios),
-	msg_count(0),
-	frun(false)
+	frun(false),
+	running(0),
+	idleWorkers(0),
+	nextWorker(0)
 {
 	name += "::CBoostSchedulerMT";
 
@@ -116,31 +310,62 @@ CBoostSchedulerMT::CBoostSchedulerMT (CNena * na, boost::shared_ptr<boost::asio:
 	messageLogRecv.open(NENA_MESSAGE_TRACE_FILE_RECV);
 #endif
 
-	for (int i=0; i < nthreads; i++)
-	{
-		worker_threads.create_thread (boost::bind(&CBoostSchedulerMT::worker_fkt, this, i));
-		rr_iterators.push_back (queues.begin ());
-	}
-
-	DBG_DEBUG(FMT("%1% starting with %2% worker threads.") % getId() % nthreads);
+	init(nthreads);
 }
 
-CBoostSchedulerMT::CBoostSchedulerMT (CNena * na, boost::shared_ptr<boost::asio::io_service> ios, int nthreads, string name):
+CBoostSchedulerMT::CBoostSchedulerMT (CNena * na, boost::shared_ptr<boost::asio::io_service> ios, int nthreads, string name, const Options & options):
 	IMessageScheduler(NULL, name),
 	nena (na),
+	options (options),
 	io_service(ios),
-	msg_count(0),
-	frun(false)
+	frun(false),
+	running(0),
+	idleWorkers(0),
+	nextWorker(0)
 {
 	this->name += "::CBoostSchedulerMT";
 
-	for (int i=0; i < nthreads; i++)
-	{
-		worker_threads.create_thread (boost::bind(&CBoostSchedulerMT::worker_fkt, this, i));
-		rr_iterators.push_back (queues.begin ());
+	init(nthreads);
+}
+
+void CBoostSchedulerMT::init (int nthreads)
+{
+	if (options.numaNode >= 0) {
+		if (!CCpuAffinity::getNodeCpus(options.numaNode, nodeCpus))
+			DBG_WARNING(FMT("%1%: unknown NUMA node %2%, not binding workers") % getId() % options.numaNode);
+		else if (!options.cpus.empty())
+			DBG_WARNING(FMT("%1%: cpus given, ignoring NUMA node %2%") % getId() % options.numaNode);
+
 	}
 
-	DBG_DEBUG(FMT("%1% starting with %2% worker threads.") % getId() % nthreads);
+	if (options.telemetry)
+		CCycleClock::calibrate();
+
+	// one block of buckets per worker, only written by its worker
+	batchHistogram.assign (nthreads * BOOSTSCHEDULER_BATCH_BUCKETS, 0);
+
+	if (options.timerBackend == t_wheel)
+		timerWheel.reset(new CTimerWheel(io_service,
+				boost::bind(&CBoostSchedulerMT::handle_wheel_timer, this, _1), options.timerTick));
+
+	if (options.mode == m_workStealing) {
+		// worker state must exist before the first thread starts
+		for (int i=0; i < nthreads; i++)
+			workers.push_back (shared_ptr<CWorker> (new CWorker()));
+
+		for (int i=0; i < nthreads; i++)
+			worker_threads.create_thread (boost::bind(&CBoostSchedulerMT::worker_ws_fkt, this, i));
+
+	} else {
+		for (int i=0; i < nthreads; i++)
+			worker_threads.create_thread (boost::bind(&CBoostSchedulerMT::worker_fkt, this, i));
+
+	}
+
+	DBG_DEBUG(FMT("%1% starting with %2% worker threads (%3%, %4% queues, %5% timers, batch size %6%).") % getId() % nthreads %
+			(options.mode == m_workStealing ? "work stealing" : "round robin") %
+			(options.queueType == q_lockFree ? "lock-free" : "locked") %
+			(options.timerBackend == t_wheel ? "wheel" : "asio") % options.batchSize);
 }
 
 CBoostSchedulerMT::~CBoostSchedulerMT ()
@@ -148,6 +373,19 @@ CBoostSchedulerMT::~CBoostSchedulerMT ()
 	worker_threads.interrupt_all();
 	worker_threads.join_all();
 
+	if (timerWheel.get() != NULL)
+		timerWheel->stop();
+
+	printBatchHistogram();
+
+	{
+		// processors may outlive us, make sure nobody sends to us anymore
+		unique_lock<shared_mutex> uniqueLock(queue_mutex);
+		map<IMessageProcessor *, shared_ptr<IMessageQueue> >::iterator it;
+		for (it = queues.begin(); it != queues.end(); it++)
+			CSchedulerRegistry::instance().erase(it->first, this);
+	}
+
 	{
 		lock_guard<mutex> lg(timerMapMutex);
 		map<deadline_timer *, shared_ptr<CTimer> >::iterator it;
@@ -168,33 +406,25 @@ CBoostSchedulerMT::~CBoostSchedulerMT ()
 
 /**
  * @brief processes all messages
+ *
+ * Processors with pending messages wait in the shared ready list, so finding
+ * work does not depend on the number of registered processors. A processor
+ * is put to the end of the list after each message (round robin).
  */
 void CBoostSchedulerMT::worker_fkt (uint32_t index) throw (ESync)
 {
-	shared_ptr<IMessage> msg;
+	workerContext.reset (new CWorkerContext (index));
 
 	DBG_INFO(boost::format("Worker Thread %1% alive!") % index);
+	pinWorker (index);
 
 	while (true)
 	{
 		/// wait for a global "go"
-		{
-			unique_lock<mutex> rlock (run_mutex);
+		if (!waitForRun (index))
+			return;
 
-			while (!frun)
-			{
-				/// this is also an interrupt point
-				try
-				{
-					run_cond.wait (rlock);
-					DBG_INFO(boost::format("Worker Thread %1% ready to work!") % index);
-				}
-				catch (boost::thread_interrupted & inter)
-				{
-					return;
-				}
-			}
-		}
+		shared_ptr<CProcessorQueue> pq;
 
 		{
 			unique_lock<mutex> mlock (msg_mutex);
@@ -202,7 +432,7 @@ void CBoostSchedulerMT::worker_fkt (uint32_t index) throw (ESync)
 			/// this is also an interrupt point
 			try
 			{
-				while (msg_count == 0)
+				while (readyList.empty () && readyListHi.empty ())
 					msg_cond.wait (mlock);
 			}
 			catch (boost::thread_interrupted & inter)
@@ -210,165 +440,556 @@ void CBoostSchedulerMT::worker_fkt (uint32_t index) throw (ESync)
 				return;
 			}
 
-			msg_count--;
+			pq = takeReady (readyListHi, readyList);
 		}
 
-		/// find an unprocessed message, through all queues (round robin like)
-		msg.reset();
+		/// only entries of promoted processors were left
+		if (pq.get () == NULL)
+			continue;
+
+		process (index, pq);
+	} // main loop
+}
+
+/**
+ * @brief applies the configured CPU affinity to the calling worker
+ *
+ * Explicit cpus pin each worker to a single core, a NUMA node only keeps
+ * the workers (and, by first touch, their memory) on that node.
+ */
+void CBoostSchedulerMT::pinWorker (uint32_t index)
+{
+	vector<int> cpus;
+
+	if (!options.cpus.empty ())
+		cpus.push_back (options.cpus[index % options.cpus.size ()]);
+	else if (!nodeCpus.empty ())
+		cpus = nodeCpus;
+	else
+		return;
+
+	if (CCpuAffinity::pinCurrentThread (cpus))
+		DBG_DEBUG(FMT("%1%: worker %2% bound to CPU(s) %3%") % getId() % index % CCpuAffinity::toString (cpus));
+	else
+		DBG_WARNING(FMT("%1%: failed to bind worker %2% to CPU(s) %3%") % getId() % index % CCpuAffinity::toString (cpus));
+}
+
+/**
+ * @brief blocks until the scheduler runs
+ *
+ * @return false if the calling thread got interrupted
+ */
+bool CBoostSchedulerMT::waitForRun (uint32_t index)
+{
+	unique_lock<mutex> rlock (run_mutex);
 
-		/// did we add or delete a message processor?
-		bool procWork = false;
-		
-		/// delete message processors
+	while (!frun)
+	{
+		/// this is also an interrupt point
+		try
 		{
-			unique_lock<shared_mutex> reglock(unregisterMutex);
-			if (!unregisterQueue.empty())
-			{
-				IMessageProcessor * proc = unregisterQueue.front();
-				unregisterQueue.pop_front();
-				
-				/// acquire unique access to the queues
-				unique_lock<shared_mutex> uniqueLock (queue_mutex);
-				std::map<IMessageProcessor *, shared_ptr<IMessageQueue> >::iterator it;
-				it = queues.find(proc);
-				if (it == queues.end()) throw EUnknowMessageProcessor(
-						str(FMT("%1%: cannot unregister unknown message processor %2% (CBoostSchedulerMT::worker_fkt)") % getId() % proc->getId()));
-				queues.erase(it);
-
-				/// reset round robin pointers, as they might be invalid now
-				std::vector<std::map<IMessageProcessor *, shared_ptr<IMessageQueue> >::iterator>::iterator vit;
-
-				for (vit = rr_iterators.begin (); vit != rr_iterators.end (); vit++)
-					*vit = queues.begin ();
-				
-				procWork = true;
-			}
+			run_cond.wait (rlock);
+			DBG_INFO(boost::format("Worker Thread %1% ready to work!") % index);
 		}
-		
-		if (!procWork)
-		/// make sure we now have all current message processors
+		catch (boost::thread_interrupted & inter)
 		{
-			unique_lock<shared_mutex> reglock(registerMutex);
-			if (!registerQueue.empty())
-			{
-				// acquire unique access to the queues
-				unique_lock<shared_mutex> uniqueLock (queue_mutex);
-
-				map<IMessageProcessor*, shared_ptr<IMessageQueue> >::const_iterator rit;
-				for (rit = registerQueue.begin(); rit != registerQueue.end(); rit++)
-					queues[rit->first] = rit->second;
-				
-				if (registerQueue.size() > 1) {
-					DBG_INFO(FMT("%1%: bulk registered %2% message processors") % getId() % registerQueue.size());
-					msg_count -= registerQueue.size()-1;
-					assert(msg_count >= 0);
+			return false;
+		}
+	}
 
-				}
+	return true;
+}
 
-				registerQueue.clear();
+/**
+ * @brief calls the receiver of the message and handles its exceptions
+ *
+ * The caller is responsible for serializing non-threadsafe receivers.
+ */
+void CBoostSchedulerMT::dispatch (shared_ptr<IMessage> & msg)
+{
+#ifdef NENA_MESSAGE_TRACE
+	logMessage(messageLogRecv, msg);
+#endif // NENA_MESSAGE_TRACE
 
-				// reset round robin pointers, as they might be invalid now
-				std::vector<std::map<IMessageProcessor *, shared_ptr<IMessageQueue> >::iterator>::iterator vit;
+	try
+	{
+		msg->getTo()->processMessage(msg);
+	}
+	catch (IMessageProcessor::EUnhandledMessage& e)
+	{
+		if (msg->getFlowState().get() != NULL &&
+			msg->getFlowState()->getOperationalState() == CFlowState::s_stale)
+		{
+			DBG_WARNING(FMT("%1%: Unhandled message exception (stale flow state, what \"%2%\")") %
+				getId() % e.what());
+
+		} else if (msg->getType() == IMessage::t_event) {
+			boost::shared_ptr<IEvent> event = msg->cast<IEvent>();
+			DBG_WARNING(FMT("%1%: Unhandled event exception (proc %2%, event %3% from %4%, what \"%5%\")") %
+				getId() %
+				event->getTo()->getId() %
+				event->getId() %
+				event->getFrom()->getId() %
+				e.what());
+
+		} else {
+			DBG_WARNING(FMT("%1%: Unhandled message exception (proc %2%, msg %3% from %4%, what \"%5%\")") %
+				getId() %
+				msg->getTo()->getId() %
+				msg->getClassName() %
+				msg->getFrom()->getId() %
+				e.what());
 
-				for (vit = rr_iterators.begin (); vit != rr_iterators.end (); vit++)
-					*vit = queues.begin ();
-				
-				procWork = true;
-			}
 		}
-		
-		if (!procWork)
-		/// need shared access to queues
+
+	}
+}
+
+/**
+ * @brief processes all messages (work stealing mode)
+ *
+ * Every worker owns a deque of processors that have pending messages. A
+ * processor is in at most one deque at a time (CProcessorQueue::scheduled),
+ * so its messages are never processed concurrently unless it is threadsafe.
+ * Workers running out of work steal from the others before going to sleep.
+ */
+void CBoostSchedulerMT::worker_ws_fkt (uint32_t index) throw (ESync)
+{
+	CWorker & self = *workers[index];
+	workerContext.reset (new CWorkerContext (index));
+
+	DBG_INFO(boost::format("Worker Thread %1% alive!") % index);
+	pinWorker (index);
+
+	while (true)
+	{
+		try
+		{
+			boost::this_thread::interruption_point ();
+		}
+		catch (boost::thread_interrupted & inter)
+		{
+			return;
+		}
+
+		if (!running.load (nena::memory_order_acquire) && !waitForRun (index))
+			return;
+
+		shared_ptr<CProcessorQueue> pq;
+
 		{
-			shared_lock<shared_mutex> qlock (queue_mutex);
+			lock_guard<mutex> lg (self.mutex);
+			pq = takeReady (self.readyHi, self.ready);
+		}
 
-			/// round robin scheduling: start searching for new messages at next MessageProc
-			//for (it_mp = queues.begin(); it_mp != queues.end(); it_mp++)
+		if (pq.get () == NULL)
+			pq = steal (index);
 
-			//uint32_t old_index = index;
-			do
+		if (pq.get () == NULL)
+		{
+			/// announce that we are idle, then look once more to not miss work
+			/// queued while we were searching
 			{
-				// increment through queues from last point on
+				lock_guard<mutex> lg (self.mutex);
+				self.sleeping = true;
+			}
+			idleWorkers.fetch_add (1);
 
-				if (rr_iterators[index] == --queues.end())
-					rr_iterators[index] = queues.begin ();
-				else
-					rr_iterators[index]++;
+			pq = steal (index);
 
-				if (!rr_iterators[index]->second->empty())
+			if (pq.get () == NULL)
+			{
+				unique_lock<mutex> lock (self.mutex);
+				if (self.sleeping && self.ready.empty () && self.readyHi.empty ())
 				{
-					msg = rr_iterators[index]->second->pop();
-
-					if (msg == NULL)
+					/// this is also an interrupt point
+					try
+					{
+						self.cond.timed_wait (lock, boost::posix_time::milliseconds (BOOSTSCHEDULER_WS_IDLE_TIMEOUT));
+					}
+					catch (boost::thread_interrupted & inter)
 					{
-						DBG_ERROR(boost::format("Worker Thread %1% popped NULL message!") % index);
-						continue;
+						idleWorkers.fetch_sub (1);
+						return;
 					}
+				}
+				self.sleeping = false;
+
+			} else {
+				lock_guard<mutex> lg (self.mutex);
+				self.sleeping = false;
 
-					if (msg->getTo() != rr_iterators[index]->first)
-						DBG_FAIL("This should not happen...");
+			}
+			idleWorkers.fetch_sub (1);
+
+			if (pq.get () == NULL)
+				continue;
+		}
+
+		process (index, pq);
+	}
+}
+
+/**
+ * @brief calls dispatch() and updates the telemetry of the processor
+ */
+void CBoostSchedulerMT::dispatch (const shared_ptr<CProcessorQueue> & pq, shared_ptr<IMessage> & msg)
+{
+	if (pq->telemetry.get () == NULL) {
+		dispatch (msg);
+		return;
+	}
+
+	uint64_t start = CCycleClock::now ();
+	CProcessorTelemetry::record (pq->telemetry->waitTime, start - msg->queueLink.stamp);
+
+	dispatch (msg);
+
+	CProcessorTelemetry::record (pq->telemetry->serviceTime, CCycleClock::now () - start);
+}
+
+/**
+ * @brief processes a message in the calling worker if possible
+ *
+ * Run-to-completion for chains of processors (e.g. building blocks): if a
+ * worker of this scheduler sends to an idle, reentrant processor without
+ * pending messages, the worker takes ownership of the receiver and calls it
+ * directly instead of queueing the message. Nesting is bounded by
+ * directCallDepth, message order is kept since the receiver's queue is empty.
+ *
+ * @return false if the message has to be queued
+ */
+bool CBoostSchedulerMT::directCall (const shared_ptr<CProcessorQueue> & pq, shared_ptr<IMessage> & msg)
+{
+	CWorkerContext * self = workerContext.get ();
+	if (self == NULL || self->depth >= options.directCallDepth || !pq->proc->isReentrant ())
+		return false;
+
+	/// take ownership like a worker picking the processor from a ready list
+	int expected = 0;
+	if (!pq->scheduled.compare_exchange (expected, 1))
+		return false;
+
+	if (!pq->empty () || !pq->registered.load (nena::memory_order_acquire)) {
+		release (self->index, pq);
+		return false;
+	}
 
 #ifdef NENA_MESSAGE_TRACE
-					logMessage(messageLogRecv, msg);
+	logMessage(messageLogSend, msg);
 #endif // NENA_MESSAGE_TRACE
 
-					try
-					{
-						if (msg->getTo()->isThreadsafe ())
-						{
-							msg->getTo()->processMessage(msg);
-						}
-						else
-						{
-							map<IMessageProcessor *, shared_ptr<mutex> >::iterator mm_it;
+	if (pq->telemetry.get () != NULL) {
+		msg->queueLink.stamp = CCycleClock::now ();
+		pq->telemetry->enqueued.fetch_add (1, nena::memory_order_relaxed);
+	}
 
+	self->depth++;
+	try
+	{
+		dispatch (pq, msg);
+	}
+	catch (...)
+	{
+		self->depth--;
+		release (self->index, pq);
+		throw;
+	}
+	self->depth--;
 
-							unique_lock<shared_mutex> uniqueLock(mp_mutex);
+	/// messages queued meanwhile are scheduled now
+	release (self->index, pq);
+	return true;
+}
 
-							if (mp_mutex_map.end () == mp_mutex_map.find(msg->getTo()))
-								mp_mutex_map[msg->getTo()] = shared_ptr<mutex> (new mutex());
+/**
+ * @brief processes up to batchSize messages of a ready processor
+ *
+ * The processor is owned by the calling worker until it is released, so
+ * non-threadsafe processors never see concurrent calls. Without batching,
+ * threadsafe processors are released before their message is processed.
+ */
+void CBoostSchedulerMT::process (uint32_t index, const shared_ptr<CProcessorQueue> & pq)
+{
+	bool early = options.batchSize <= 1 && pq->proc->isThreadsafe ();
+	uint32_t n = 0;
+
+	while (n < options.batchSize)
+	{
+		if (!pq->registered.load (nena::memory_order_acquire))
+		{
+			/// message processor is gone, its messages die with the queue
+			pq->scheduled.store (0);
+			recordBatch (index, n);
+			return;
+		}
 
+		shared_ptr<IMessage> msg = pq->pop ();
 
-							/// only lock the mutex of the Message Processor
-							lock_guard<mutex> mp_guard(*mp_mutex_map[msg->getTo()]);
-							msg->getTo()->processMessage(msg);
-						}
-					}
-					catch (IMessageProcessor::EUnhandledMessage& e)
-					{
-						if (msg->getFlowState().get() != NULL &&
-							msg->getFlowState()->getOperationalState() == CFlowState::s_stale)
-						{
-							DBG_WARNING(FMT("%1%: Unhandled message exception (stale flow state, what \"%2%\")") %
-								getId() % e.what());
-
-						} else if (msg->getType() == IMessage::t_event) {
-							boost::shared_ptr<IEvent> event = msg->cast<IEvent>();
-							DBG_WARNING(FMT("%1%: Unhandled event exception (proc %2%, event %3% from %4%, what \"%5%\")") %
-								getId() %
-								event->getTo()->getId() %
-								event->getId() %
-								event->getFrom()->getId() %
-								e.what());
-
-						} else {
-							DBG_WARNING(FMT("%1%: Unhandled message exception (proc %2%, msg %3% from %4%, what \"%5%\")") %
-								getId() %
-								msg->getTo()->getId() %
-								msg->getClassName() %
-								msg->getFrom()->getId() %
-								e.what());
-
-						}
+		/// either drained, a producer is not done yet or we lost a race
+		if (msg == NULL)
+			break;
 
-					}
+		if (msg->getTo() != pq->proc)
+			DBG_FAIL("This should not happen...");
 
-					break;
-				} // queue not empty
-			} // check all queues
-			while (true); //(old_index = index);
-		} // local scope
-	} // main loop
+		n++;
+
+		if (early)
+		{
+			/// let other workers take the next message right away
+			recordBatch (index, n);
+			release (index, pq);
+			dispatch (pq, msg);
+			return;
+		}
+
+		dispatch (pq, msg);
+	}
+
+	recordBatch (index, n);
+	release (index, pq);
+}
+
+/**
+ * @brief counts a batch in the histogram of the worker
+ */
+void CBoostSchedulerMT::recordBatch (uint32_t index, uint32_t n)
+{
+	if (n == 0)
+		return;
+
+	uint32_t bucket = 0;
+	while ((n >>= 1) != 0 && bucket < BOOSTSCHEDULER_BATCH_BUCKETS - 1)
+		bucket++;
+
+	batchHistogram[index * BOOSTSCHEDULER_BATCH_BUCKETS + bucket]++;
+}
+
+/**
+ * @brief sums up the batch histograms of all workers
+ *
+ * Bucket i counts batches of 2^i to 2^(i+1)-1 messages, the last bucket
+ * counts all larger batches. Only exact once the workers are stopped.
+ */
+void CBoostSchedulerMT::getBatchHistogram (std::vector<uint64_t> & histogram) const
+{
+	histogram.assign (BOOSTSCHEDULER_BATCH_BUCKETS, 0);
+	for (size_t i = 0; i < batchHistogram.size (); i++)
+		histogram[i % BOOSTSCHEDULER_BATCH_BUCKETS] += batchHistogram[i];
+}
+
+void CBoostSchedulerMT::printBatchHistogram () const
+{
+	vector<uint64_t> histogram;
+	getBatchHistogram (histogram);
+
+	for (uint32_t i = 0; i < histogram.size (); i++) {
+		if (histogram[i] > 0)
+			DBG_INFO(FMT("[STAT] [BATCH] [%1%] [%2%] %3%") % getId() % (1u << i) % histogram[i]);
+	}
+}
+
+/**
+ * @brief hands a processor with pending messages to a worker
+ *
+ * In work stealing mode, workers of this scheduler keep the processor for
+ * themselves (it will most likely be processed by the same core), other
+ * threads distribute round robin.
+ *
+ * @param urgent	use the high priority ready list
+ */
+void CBoostSchedulerMT::schedule (const shared_ptr<CProcessorQueue> & pq, bool urgent)
+{
+	if (options.mode != m_workStealing) {
+		{
+			lock_guard<mutex> mlock (msg_mutex);
+			if (urgent) {
+				readyListHi.push_back (pq);
+			} else {
+				pq->queuedLo.store (1);
+				readyList.push_back (pq);
+			}
+			msg_cond.notify_one ();
+		}
+
+		/// a high priority message may have arrived after we decided
+		if (!urgent && pq->urgent ())
+			promote (pq);
+		return;
+	}
+
+	CWorkerContext * self = workerContext.get ();
+	uint32_t target = (self != NULL) ? self->index : nextWorker.fetch_add (1) % workers.size ();
+	CWorker & w = *workers[target];
+	bool woken = false;
+
+	{
+		lock_guard<mutex> lg (w.mutex);
+		if (urgent) {
+			w.readyHi.push_back (pq);
+		} else {
+			pq->queuedLo.store (1);
+			w.ready.push_back (pq);
+		}
+		if (w.sleeping) {
+			w.sleeping = false;
+			w.cond.notify_one ();
+			woken = true;
+		}
+	}
+
+	if (!woken)
+		wakeIdleWorker ();
+
+	if (!urgent && pq->urgent ())
+		promote (pq);
+}
+
+/**
+ * @brief moves a processor waiting for bulk data to a high priority ready list
+ *
+ * Processors enter a ready list once, when they become scheduled. A timer,
+ * event or control message arriving later would wait behind all bulk data
+ * of the other processors. The processor gets an additional entry in a
+ * high priority list instead, its old entry becomes stale and is skipped
+ * by takeReady(). Does nothing if the processor is not waiting in a bulk
+ * data list (it is in a high priority list or being processed already).
+ */
+void CBoostSchedulerMT::promote (const shared_ptr<CProcessorQueue> & pq)
+{
+	int expected = 1;
+	if (pq->queuedLo.compare_exchange (expected, 0))
+		schedule (pq, true);
+}
+
+/**
+ * @brief wakes up an idle worker so it can steal work
+ */
+void CBoostSchedulerMT::wakeIdleWorker ()
+{
+	if (idleWorkers.load () == 0)
+		return;
+
+	std::vector<shared_ptr<CWorker> >::iterator it;
+	for (it = workers.begin (); it != workers.end (); it++)
+	{
+		lock_guard<mutex> lg ((*it)->mutex);
+		if ((*it)->sleeping) {
+			(*it)->sleeping = false;
+			(*it)->cond.notify_one ();
+			return;
+		}
+	}
+}
+
+/**
+ * @brief takes a ready processor from another worker
+ *
+ * @return processor or NULL if all other deques are empty
+ */
+shared_ptr<CProcessorQueue> CBoostSchedulerMT::steal (uint32_t index)
+{
+	shared_ptr<CProcessorQueue> pq;
+
+	for (size_t i = 1; i < workers.size (); i++)
+	{
+		CWorker & victim = *workers[(index + i) % workers.size ()];
+
+		lock_guard<mutex> lg (victim.mutex);
+		pq = takeReady (victim.readyHi, victim.ready);
+		if (pq.get () != NULL)
+			break;
+	}
+
+	return pq;
+}
+
+/**
+ * @brief puts a processor back into a ready list or marks it idle
+ */
+void CBoostSchedulerMT::release (uint32_t index, const shared_ptr<CProcessorQueue> & pq)
+{
+	if (pq->empty ()) {
+		pq->scheduled.store (0);
+
+		/// a sender may have pushed right before we reset the flag
+		int expected = 0;
+		if (pq->empty () || !pq->scheduled.compare_exchange (expected, 1))
+			return;
+	}
+
+	bool urgent = pq->urgent ();
+
+	if (options.mode != m_workStealing) {
+		lock_guard<mutex> mlock (msg_mutex);
+		if (urgent) {
+			readyListHi.push_back (pq);
+		} else {
+			pq->queuedLo.store (1);
+			readyList.push_back (pq);
+		}
+		msg_cond.notify_one ();
+
+	} else {
+		CWorker & self = *workers[index];
+
+		lock_guard<mutex> lg (self.mutex);
+		if (urgent) {
+			self.readyHi.push_back (pq);
+		} else {
+			pq->queuedLo.store (1);
+			self.ready.push_back (pq);
+		}
+	}
+
+	if (!urgent && pq->urgent ())
+		promote (pq);
+}
+
+/**
+ * @brief takes the next processor from a pair of ready lists
+ *
+ * Processors with high priority messages come first. In weighted mode, a
+ * worker takes at most priorityWeight of them in a row while others wait.
+ * Stale entries of promoted processors are dropped. Needs the lock of the
+ * lists.
+ */
+shared_ptr<CProcessorQueue> CBoostSchedulerMT::takeReady (std::deque<shared_ptr<CProcessorQueue> > & hi,
+		std::deque<shared_ptr<CProcessorQueue> > & lo)
+{
+	shared_ptr<CProcessorQueue> pq;
+	CWorkerContext * self = workerContext.get ();
+
+	for (;;)
+	{
+		bool yield = options.priorities == pr_weighted && self != NULL &&
+				self->hiStreak >= options.priorityWeight && !lo.empty ();
+
+		if (!hi.empty () && !yield) {
+			pq = hi.front ();
+			hi.pop_front ();
+			if (self != NULL)
+				self->hiStreak++;
+			return pq;
+		}
+
+		if (lo.empty ())
+			return pq;
+
+		pq = lo.front ();
+		lo.pop_front ();
+
+		/// skip stale entries of promoted processors
+		int expected = 1;
+		if (pq->queuedLo.compare_exchange (expected, 0)) {
+			if (self != NULL)
+				self->hiStreak = 0;
+			return pq;
+		}
+
+		pq.reset ();
+	}
 }
 
 /**
@@ -381,6 +1002,7 @@ void CBoostSchedulerMT::run ()
 {
 	lock_guard<mutex> rlock (run_mutex);
 	frun = true;
+	running.store (1, nena::memory_order_release);
 	run_cond.notify_all ();
 	//io_thread = worker_threads.create_thread (boost::bind(&CBoostSchedulerMT::io_run, this));
 
@@ -399,6 +1021,7 @@ void CBoostSchedulerMT::stop ()
 
 	lock_guard<mutex> rlock (run_mutex);
 	frun = false;
+	running.store (0, nena::memory_order_release);
 
 	//worker_threads.remove_thread(io_thread);
 	DBG_DEBUG(FMT("%1%: stopped") % getId());
@@ -411,46 +1034,35 @@ void CBoostSchedulerMT::registerMessageProcessor(IMessageProcessor *proc) throw
 {
 	if (proc == NULL) throw EUnknowMessageProcessor("processor == NULL");
 
-	bool found = false;
-
-	{
-		shared_lock<shared_mutex> uplock(queue_mutex);
-		found = queues.find(proc) != queues.end();
-	}
-
-	if (found) {
-		// check whether it is already in the unregister queue
-		shared_lock<shared_mutex> reglock(unregisterMutex);
-		std::list<IMessageProcessor *>::iterator it;
-		for (it = unregisterQueue.begin(); it != unregisterQueue.end(); it++) {
-			if (*it == proc) {
-				found = false;
-				break;
-			}
-		}
-
+	shared_ptr<IMessageQueue> q;
+	if (options.queueType == q_lockFree)
+		q.reset(new CMpscMessageQueue());
+	else
+		q.reset(new CSyncMessageQueue());
+
+	shared_ptr<IMessageQueue> qHi;
+	if (options.priorities != pr_none) {
+		if (options.queueType == q_lockFree)
+			qHi.reset(new CMpscMessageQueue());
+		else
+			qHi.reset(new CSyncMessageQueue());
 	}
 
-	if (found)
-		throw EAlreadyRegistered("message processor already registered");
-
-	// not found
-	{
-//		DBG_DEBUG(FMT("%1%: registering %2%(%3%)") % getId() % proc->getId() % proc->getClassName());
-
-		shared_ptr<CSyncMessageQueue> mq(new CSyncMessageQueue());
+	shared_ptr<CProcessorTelemetry> telemetry;
+	if (options.telemetry)
+		telemetry.reset(new CProcessorTelemetry());
 
-		unique_lock<shared_mutex> reglock(registerMutex);
-		if (registerQueue.find(proc) != registerQueue.end())
-			throw EAlreadyRegistered("message processor already in register queue");
+	shared_ptr<IMessageQueue> mq(new CProcessorQueue(proc, q, qHi,
+			options.priorities == pr_weighted ? options.priorityWeight : 0, telemetry));
 
-		registerQueue[proc] = mq;
-	}
+	// workers do not hold the queue lock while processing, so this is safe
+	// to be called from within processMessage()
+	unique_lock<shared_mutex> uniqueLock(queue_mutex);
+	if (queues.find(proc) != queues.end())
+		throw EAlreadyRegistered("message processor already registered");
 
-	/// notify worker threads
-	lock_guard<mutex> mlock(msg_mutex);
-	msg_count++;
-	msg_cond.notify_one();
+	queues[proc] = mq;
+	CSchedulerRegistry::instance().insert(proc, this);
 };
 
 /**
@@ -461,35 +1073,19 @@ void CBoostSchedulerMT::unregisterMessageProcessor(IMessageProcessor *proc) thro
 	if (proc == NULL)
 		throw EUnknowMessageProcessor("processor == NULL");
 
-	{
-		// check whether it is still in our register queue
-		unique_lock<shared_mutex> reglock(registerMutex);
-		map<IMessageProcessor*, boost::shared_ptr<IMessageQueue> >::iterator rqit = registerQueue.find(proc);
-		if (rqit != registerQueue.end()) {
-			// yes, erase it
-			registerQueue.erase(rqit);
-			return;
-		}
-	}
-
-	{
-		shared_lock<shared_mutex> uplock(queue_mutex);
-		std::map<IMessageProcessor *, shared_ptr<IMessageQueue> >::iterator it;
-		it = queues.find(proc);
-		if (it == queues.end()) {
-			throw EUnknowMessageProcessor(
-				str(FMT("%1%: cannot unregister unknown message processor %2% (CBoostSchedulerMT::unregisterMessageProcessor())") % getId() % proc->getId()));
+	unique_lock<shared_mutex> uniqueLock(queue_mutex);
+	std::map<IMessageProcessor *, shared_ptr<IMessageQueue> >::iterator it;
+	it = queues.find(proc);
+	if (it == queues.end()) {
+		throw EUnknowMessageProcessor(
+			str(FMT("%1%: cannot unregister unknown message processor %2% (CBoostSchedulerMT::unregisterMessageProcessor())") % getId() % proc->getId()));
 
-		}
 	}
-	
-	unique_lock<shared_mutex> reglock(unregisterMutex);
-	unregisterQueue.push_back(proc);
 
-	/// notify worker threads
-	lock_guard<mutex> mlock(msg_mutex);
-	msg_count++;
-	msg_cond.notify_one();
+	// a worker or ready list may still hold the queue, tell it to drop the messages
+	boost::static_pointer_cast<CProcessorQueue>(it->second)->registered.store(0);
+	queues.erase(it);
+	CSchedulerRegistry::instance().erase(proc, this);
 };
 
 void CBoostSchedulerMT::handle_timer (deadline_timer * t)
@@ -515,8 +1111,19 @@ void CBoostSchedulerMT::handle_timer (deadline_timer * t)
 	delete t;
 }
 
+void CBoostSchedulerMT::handle_wheel_timer (shared_ptr<CTimer> & timer)
+{
+	shared_ptr<IMessage> msg = boost::dynamic_pointer_cast<IMessage>(timer);
+	sendMessage(msg);
+}
+
 void CBoostSchedulerMT::setTimer(shared_ptr<CTimer>& timer)
 {
+	if (timerWheel.get() != NULL) {
+		timerWheel->set(timer);
+		return;
+	}
+
 	deadline_timer* t = new deadline_timer(*io_service);
 
 	boost::posix_time::time_duration td = boost::posix_time::milliseconds ((long) (timer->timeout*1000));
@@ -532,7 +1139,12 @@ void CBoostSchedulerMT::setTimer(shared_ptr<CTimer>& timer)
 
 void CBoostSchedulerMT::cancelTimer(shared_ptr<CTimer>& timer)
 {
-	deadline_timer * t;
+	if (timerWheel.get() != NULL) {
+		timerWheel->cancel(timer);
+		return;
+	}
+
+	deadline_timer * t = NULL;
 	{
 		lock_guard<mutex> lg(timerMapMutex);
 		map<shared_ptr<CTimer>, deadline_timer *>::iterator tit = reverseTimerMap.find(timer);
@@ -546,8 +1158,10 @@ void CBoostSchedulerMT::cancelTimer(shared_ptr<CTimer>& timer)
 			}
 		}
 	}
-	t->cancel();
-	delete t;
+	if (t != NULL) {
+		t->cancel();
+		delete t;
+	}
 }
 
 /**
@@ -566,85 +1180,55 @@ void CBoostSchedulerMT::sendMessage(boost::shared_ptr<IMessage>& msg) throw (EUn
 	map<IMessageProcessor *, shared_ptr<IMessageQueue> >::iterator it;
 
 	IMessageProcessor *src = msg->getFrom();
+	IMessageProcessor *dest = msg->getTo();
+	shared_ptr<CProcessorQueue> pq;
 
-	/// we need shared access to the queues, but perhaps we already have (if
-	shared_lock<shared_mutex> qlock (queue_mutex);
+	bool localSrc;
 
-	if (queues.find(src) == queues.end()) {
-		// check if it is in our register queue
-		bool found = false;
-		{
-			shared_lock<shared_mutex> reglock(registerMutex);
-			found = registerQueue.find(src) != registerQueue.end();
-		}
+	{
+		/// we need shared access to the queues
+		shared_lock<shared_mutex> qlock (queue_mutex);
 
-		if (!found) {
-			// src message processor not in our queues, look for others
-			// happens in passMessage TODO: can we get rid of this?
-			IMessageScheduler * ims = NULL;
-			lock_guard<shared_mutex> lg(src_cache_mutex);
-			if (src_cache.find(src) == src_cache.end ()) {
-				ims = nena->lookupScheduler(src);
-				if (ims == NULL) {
-					string errstr(str(FMT("%1%: unknown src message processor %2% (CBoostSchedulerMT::sendMessage())") % getId() % src->getId()));
-					throw EUnknowMessageProcessor(errstr);
-				}
-				else
-					src_cache[src] = ims;
-			}
+		localSrc = queues.find(src) != queues.end();
 
-		}
+		it = queues.find(dest);
+		if (it != queues.end())
+			pq = boost::static_pointer_cast<CProcessorQueue>(it->second);
 	}
 
-	IMessageProcessor *dest = msg->getTo();
-	it = queues.find(dest);
-	if (it == queues.end()) {
-		// check if it is in our register queue
-		bool found = false;
-		{
-			unique_lock<shared_mutex> reglock(registerMutex);
-			map<IMessageProcessor*, shared_ptr<IMessageQueue> >::iterator rit;
-			rit = registerQueue.find(dest);
-			if (rit != registerQueue.end()) {
-				found = true;
-				rit->second->push(msg);
-				DBG_INFO(FMT("%1%: queueing message for message processor in register queue") % getId());
-
-				// continue to end of function
-			}
-		}
-
-		if (!found) {
-			/// dest message processor not in our queues, look for others
-			IMessageScheduler * ims = NULL;
-			lock_guard<shared_mutex> lg(dest_cache_mutex);
-			if (dest_cache.find(dest) == dest_cache.end ()) {
-				ims = nena->lookupScheduler(dest);
-				if (ims == NULL) {
-					string errstr(str(FMT("%1%: unknown dest message processor %2% (CBoostSchedulerMT::sendMessage())") % getId() % dest->getId()));
-					throw EUnknowMessageProcessor(errstr);
-				} else {
-					dest_cache[dest] = ims;
-				}
-			}
+	// src message processor not in our queues (e.g. passMessage), it must belong to another scheduler
+	if (!localSrc && CSchedulerRegistry::instance().lookup(src) == NULL) {
+		string errstr(str(FMT("%1%: unknown src message processor %2% (CBoostSchedulerMT::sendMessage())") % getId() % src->getId()));
+		throw EUnknowMessageProcessor(errstr);
+	}
 
-			dest_cache[dest]->passMessage(msg);
-			return;
+	if (pq.get() == NULL) {
+		/// dest message processor not in our queues, hand it to its scheduler
+		IMessageScheduler * ims = CSchedulerRegistry::instance().lookup(dest);
+		if (ims == NULL || ims == this) {
+			string errstr(str(FMT("%1%: unknown dest message processor %2% (CBoostSchedulerMT::sendMessage())") % getId() % dest->getId()));
+			throw EUnknowMessageProcessor(errstr);
 		}
 
-	} else {
-		it->second->push (msg); // enqueue message
-
+		ims->passMessage(msg);
+		return;
 	}
 
+	if (options.directCallDepth > 0 && directCall (pq, msg))
+		return;
+
+	pq->push (msg); // enqueue message
+
 #ifdef NENA_MESSAGE_TRACE
 	logMessage(messageLogSend, msg);
 #endif // NENA_MESSAGE_TRACE
 
-	/// notify worker threads
-	lock_guard<mutex> mlock(msg_mutex);
-	msg_count++;
-	msg_cond.notify_one();
+	/// hand the processor to a worker unless it already has one
+	int expected = 0;
+	if (pq->scheduled.compare_exchange(expected, 1))
+		schedule(pq, pq->urgent());
+	else if (pq->queuedLo.load() == 1 && pq->urgent())
+		promote(pq);
 }
 
 void CBoostSchedulerMT::processMessages() throw (EUnknowMessageProcessor, EBadCall)
@@ -654,21 +1238,44 @@ void CBoostSchedulerMT::processMessages() throw (EUnknowMessageProcessor, EBadCa
 
 bool CBoostSchedulerMT::hasMessageProcessor (IMessageProcessor * proc)
 {
-	bool found = false;
+	// we need shared access to the queues
+	shared_lock<shared_mutex> qlock (queue_mutex);
+	return queues.find(proc) != queues.end();
+}
+
+void CBoostSchedulerMT::getProcessorStatistics (std::list<CProcessorStatistics> & stats)
+{
+	if (!options.telemetry)
+		return;
+
+	uint64_t now = CCycleClock::now ();
 
+	/// we need shared access to the queues
+	shared_lock<shared_mutex> qlock (queue_mutex);
+
+	map<IMessageProcessor *, shared_ptr<IMessageQueue> >::const_iterator it;
+	for (it = queues.begin (); it != queues.end (); it++)
 	{
-		// we need shared access to the queues
-		shared_lock<shared_mutex> qlock (queue_mutex);
-		found = queues.find(proc) != queues.end();
-	}
+		shared_ptr<CProcessorQueue> pq = boost::static_pointer_cast<CProcessorQueue> (it->second);
+		const CProcessorTelemetry & t = *pq->telemetry;
+
+		CProcessorStatistics ps;
+		ps.processor = it->first->getId ();
+		ps.enqueued = t.enqueued.load (nena::memory_order_relaxed);
+		ps.queueDepth = max (t.depth.load (nena::memory_order_relaxed), 0);
+		ps.maxQueueDepth = t.maxDepth.load (nena::memory_order_relaxed);
+
+		double us = CCycleClock::toMicroseconds (now - t.registered);
+		if (us > 0)
+			ps.enqueueRate = ps.enqueued / us * 1000000;
+
+		for (uint32_t i = 0; i < BOOSTSCHEDULER_TELEMETRY_BUCKETS; i++) {
+			ps.waitTime.push_back (t.waitTime[i].load (nena::memory_order_relaxed));
+			ps.serviceTime.push_back (t.serviceTime[i].load (nena::memory_order_relaxed));
+		}
 
-	if (!found) {
-		// check if it is in our register queue
-		shared_lock<shared_mutex> reglock(registerMutex);
-		found = registerQueue.find(proc) != registerQueue.end();
+		stats.push_back (ps);
 	}
-
-	return found;
 }
 
 void CBoostSchedulerMT::passMessage (boost::shared_ptr<IMessage> msg)
@@ -15,13 +15,18 @@
 
 #include "messages.h"
 #include "nena.h"
+#include "atomics.h"
+#include "timerWheel.h"
+#include "cycleClock.h"
 
 #include <boost/asio.hpp>
 #include <boost/thread/thread.hpp>
+#include <boost/thread/tss.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/thread/shared_mutex.hpp>
 
 #include <queue>
+#include <deque>
 #include <map>
 #include <vector>
 #include <fstream>
@@ -29,6 +34,12 @@
 // log messages to log file(s)
 //#define NENA_MESSAGE_TRACE
 
+/// number of buckets of the batch size histogram (powers of two)
+#define BOOSTSCHEDULER_BATCH_BUCKETS 16
+
+/// number of buckets of the telemetry histograms (powers of two microseconds)
+#define BOOSTSCHEDULER_TELEMETRY_BUCKETS 24
+
 /**
  * @brief Message Queue for use in multithreaded environments
  */
@@ -58,6 +69,192 @@ class CSyncMessageQueue : public IMessageQueue
 bool operator== (CSyncMessageQueue &, CSyncMessageQueue &);
 bool operator!= (CSyncMessageQueue &, CSyncMessageQueue &);
 
+/**
+ * @brief Lock-free multi-producer/single-consumer message queue
+ *
+ * Intrusive queue after D. Vyukov, linking messages through
+ * IMessage::queueLink, so push() neither locks nor allocates. pop() must not
+ * be called concurrently; it may return NULL while a producer is half way
+ * through push() although empty() is already false.
+ */
+class CMpscMessageQueue : public IMessageQueue
+{
+	private:
+	nena::atomic<CMessageLink *> head;		///< last pushed link (producers)
+	CMessageLink * tail;					///< next link to pop (consumer)
+	CMessageLink stub;
+	nena::atomic<size_t> count;
+
+	void pushLink (CMessageLink * link);
+
+	// not copyable
+	CMpscMessageQueue (const CMpscMessageQueue &);
+	CMpscMessageQueue & operator= (const CMpscMessageQueue &);
+
+	public:
+	CMpscMessageQueue ();
+	virtual ~CMpscMessageQueue ();
+
+	virtual boost::shared_ptr<IMessage> pop ();
+	virtual void push (boost::shared_ptr<IMessage>);
+
+	virtual bool empty () const;
+	virtual size_t size () const;
+};
+
+/**
+ * @brief Telemetry counters of a single message processor
+ *
+ * Counters touched by senders are atomic, the histograms are only written by
+ * the worker owning the processor (racy for threadsafe processors, which may
+ * be processed by several workers at once).
+ */
+class CProcessorTelemetry
+{
+	public:
+	const uint64_t registered;			///< CCycleClock time of registration
+	nena::atomic<uint64_t> enqueued;
+	nena::atomic<int> depth;
+	nena::atomic<int> maxDepth;
+	nena::atomic<uint64_t> waitTime[BOOSTSCHEDULER_TELEMETRY_BUCKETS];		///< time in queue
+	nena::atomic<uint64_t> serviceTime[BOOSTSCHEDULER_TELEMETRY_BUCKETS];	///< time in processMessage()
+
+	CProcessorTelemetry () : registered(CCycleClock::now()), enqueued(0), depth(0), maxDepth(0) {}
+
+	/// a message was queued
+	inline void pushed ()
+	{
+		enqueued.fetch_add(1, nena::memory_order_relaxed);
+		int d = depth.fetch_add(1, nena::memory_order_relaxed) + 1;
+		int m = maxDepth.load(nena::memory_order_relaxed);
+		while (d > m && !maxDepth.compare_exchange(m, d, nena::memory_order_relaxed));
+	}
+
+	/// a message left the queue
+	inline void popped ()
+	{
+		depth.fetch_sub(1, nena::memory_order_relaxed);
+	}
+
+	/// count a duration in one of the histograms (single writer)
+	static inline void record (nena::atomic<uint64_t> * histogram, uint64_t cycles)
+	{
+		uint64_t us = (uint64_t) CCycleClock::toMicroseconds(cycles);
+		uint32_t bucket = 0;
+		while ((us >>= 1) != 0 && bucket < BOOSTSCHEDULER_TELEMETRY_BUCKETS - 1)
+			bucket++;
+
+		histogram[bucket].store(histogram[bucket].load(nena::memory_order_relaxed) + 1, nena::memory_order_relaxed);
+	}
+};
+
+/**
+ * @brief Message queue of a single message processor plus its scheduling state
+ *
+ * Storage is delegated to the wrapped queues. With priorities, timers,
+ * events and messages of control processors go to qHi and are popped before
+ * bulk data (at most weight in a row if weight > 0).
+ */
+class CProcessorQueue : public IMessageQueue
+{
+	public:
+	IMessageProcessor * const proc;					///< owner of the queue
+	const boost::shared_ptr<IMessageQueue> q;		///< actual message storage (bulk data)
+	const boost::shared_ptr<IMessageQueue> qHi;		///< high priority messages, NULL without priorities
+	const uint32_t weight;							///< high priority messages in a row, 0 for strict priority
+	const boost::shared_ptr<CProcessorTelemetry> telemetry;	///< NULL if disabled
+
+	/// 1 while the processor sits in a ready list or is being processed
+	nena::atomic<int> scheduled;
+	/// reset on unregister, remaining messages will be dropped
+	nena::atomic<int> registered;
+	/// 1 while the processor waits in a bulk data ready list, reset by the
+	/// worker taking it or by CBoostSchedulerMT::promote()
+	nena::atomic<int> queuedLo;
+
+	private:
+	/// 1 if proc->isControlProcessor(), -1 if not determined yet (must not be
+	/// asked while the processor registers from its base class constructor)
+	nena::atomic<int> control;
+	/// high priority messages popped in a row (owner only)
+	uint32_t hiStreak;
+
+	public:
+	CProcessorQueue (IMessageProcessor * proc, boost::shared_ptr<IMessageQueue> q,
+			boost::shared_ptr<IMessageQueue> qHi = boost::shared_ptr<IMessageQueue>(), uint32_t weight = 0,
+			boost::shared_ptr<CProcessorTelemetry> telemetry = boost::shared_ptr<CProcessorTelemetry>()) :
+		proc(proc), q(q), qHi(qHi), weight(weight), telemetry(telemetry), scheduled(0), registered(1),
+		queuedLo(0), control(-1), hiStreak(0) {}
+	virtual ~CProcessorQueue () {}
+
+	virtual boost::shared_ptr<IMessage> pop ()
+	{
+		boost::shared_ptr<IMessage> msg = popQueues();
+		if (telemetry.get() != NULL && msg.get() != NULL)
+			telemetry->popped();
+
+		return msg;
+	}
+
+	virtual void push (boost::shared_ptr<IMessage> msg)
+	{
+		if (telemetry.get() != NULL) {
+			msg->queueLink.stamp = CCycleClock::now();
+			telemetry->pushed();
+		}
+
+		if (qHi.get() != NULL && isUrgent(msg))
+			qHi->push(msg);
+		else
+			q->push(msg);
+	}
+
+	virtual bool empty () const { return q->empty() && (qHi.get() == NULL || qHi->empty()); }
+	virtual size_t size () const { return q->size() + (qHi.get() != NULL ? qHi->size() : 0); }
+
+	/// true if high priority messages are pending
+	bool urgent () const { return qHi.get() != NULL && !qHi->empty(); }
+
+	private:
+	boost::shared_ptr<IMessage> popQueues ()
+	{
+		if (qHi.get() == NULL)
+			return q->pop();
+
+		boost::shared_ptr<IMessage> msg;
+		if (weight == 0 || hiStreak < weight) {
+			msg = qHi->pop();
+			if (msg.get() != NULL) {
+				hiStreak++;
+				return msg;
+			}
+		}
+
+		msg = q->pop();
+		if (msg.get() != NULL) {
+			hiStreak = 0;
+			return msg;
+		}
+
+		return qHi->pop();
+	}
+
+	/// true for all but data messages of non-control processors
+	bool isUrgent (const boost::shared_ptr<IMessage> & msg)
+	{
+		if (msg->getType() != IMessage::t_incoming && msg->getType() != IMessage::t_outgoing)
+			return true;
+
+		int c = control.load(nena::memory_order_relaxed);
+		if (c < 0) {
+			c = proc->isControlProcessor() ? 1 : 0;
+			control.store(c, nena::memory_order_relaxed);
+		}
+
+		return c == 1;
+	}
+};
+
 /*****************************************************************************/
 
 class CBoostSchedulerMT : public IMessageScheduler
@@ -79,9 +276,105 @@ public:
 		virtual const char* what() const throw () { return msg.c_str(); };
 	};
 
+	/**
+	 * @brief	How worker threads find their work
+	 */
+	enum Mode
+	{
+		m_roundRobin,		///< all workers share the processor queues (default)
+		m_workStealing		///< per-worker deques of ready processors, idle workers steal
+	};
+
+	/**
+	 * @brief	Message queue implementation used for the processors
+	 */
+	enum QueueType
+	{
+		q_locked,			///< CSyncMessageQueue (default)
+		q_lockFree			///< CMpscMessageQueue
+	};
+
+	/**
+	 * @brief	Priority classes of messages
+	 */
+	enum PriorityMode
+	{
+		pr_none,			///< FIFO (default)
+		pr_strict,			///< timers, events and control traffic always first
+		pr_weighted			///< like strict, but at most priorityWeight in a row while bulk data waits
+	};
+
+	/**
+	 * @brief	Implementation of setTimer()/cancelTimer()
+	 */
+	enum TimerBackend
+	{
+		t_asio,				///< one deadline_timer per CTimer (default)
+		t_wheel				///< CTimerWheel driven by a single deadline_timer
+	};
+
+	/**
+	 * @brief	Scheduler configuration
+	 */
+	class Options
+	{
+	public:
+		Mode mode;
+		QueueType queueType;
+		uint32_t batchSize;		///< max. messages processed per processor before releasing it
+		TimerBackend timerBackend;
+		double timerTick;		///< tick length of the timer wheel in seconds
+		std::vector<int> cpus;	///< worker i is pinned to cpus[i % cpus.size()], empty for no pinning
+		int numaNode;			///< without cpus, workers are bound to all CPUs of this node (-1 for none)
+		uint32_t directCallDepth;	///< max. nesting of inline calls to reentrant processors (0 disables them)
+		PriorityMode priorities;
+		uint32_t priorityWeight;
+		bool telemetry;			///< per processor counters, see getProcessorStatistics()
+
+		Options () : mode(m_roundRobin), queueType(q_locked), batchSize(1), timerBackend(t_asio), timerTick(0.001),
+				numaNode(-1), directCallDepth(0), priorities(pr_none), priorityWeight(8), telemetry(false) {}
+
+		/**
+		 * @brief	Set an option from its configuration string
+		 *
+		 * @return	false if key or value are unknown
+		 */
+		bool set (const std::string & key, const std::string & value);
+	};
+
 private:
+	/**
+	 * @brief	Per-worker state in work stealing mode
+	 */
+	class CWorker
+	{
+	public:
+		boost::mutex mutex;		///< protects ready and sleeping
+		boost::condition_variable cond;
+		std::deque<boost::shared_ptr<CProcessorQueue> > ready;	///< processors with pending messages
+		std::deque<boost::shared_ptr<CProcessorQueue> > readyHi;	///< processors with high priority messages
+		bool sleeping;
+
+		CWorker () : sleeping(false) {}
+	};
+
+	/**
+	 * @brief	Thread local state of a worker thread
+	 */
+	class CWorkerContext
+	{
+	public:
+		uint32_t index;
+		uint32_t depth;		///< current nesting of direct calls
+		uint32_t hiStreak;	///< high priority processors taken in a row
+
+		CWorkerContext (uint32_t index) : index(index), depth(0), hiStreak(0) {}
+	};
+
 	CNena* nena;
 
+	Options options;
+
 #ifdef NENA_MESSAGE_TRACE
 	std::ofstream messageLogSend;
 	std::ofstream messageLogRecv;
@@ -92,8 +385,9 @@ private:
 	/// Worker Thread Group
 	boost::thread_group worker_threads;
 
-	/// semaphore workaround for message count
-	int msg_count;
+	/// round robin: processors with pending messages, each listed at most once
+	std::deque<boost::shared_ptr<CProcessorQueue> > readyList;
+	std::deque<boost::shared_ptr<CProcessorQueue> > readyListHi;	///< processors with high priority messages
 	boost::mutex msg_mutex;
 	boost::condition_variable msg_cond;
 
@@ -101,45 +395,94 @@ private:
 	bool frun;
 	boost::mutex run_mutex;
 	boost::condition_variable run_cond;
+	nena::atomic<int> running;		///< mirrors frun for lock-free polling
 
-	/// protects the queues
-	boost::shared_mutex queue_mutex;
+	/// work stealing: one entry per worker thread
+	std::vector<boost::shared_ptr<CWorker> > workers;
+	nena::atomic<int> idleWorkers;
+	nena::atomic<uint32_t> nextWorker;		///< target for messages from foreign threads
+	boost::thread_specific_ptr<CWorkerContext> workerContext;	///< state of the calling worker, NULL for foreign threads
 
-	/// round robin pointers to queue
-	std::vector<std::map<IMessageProcessor *, boost::shared_ptr<IMessageQueue> >::iterator> rr_iterators;
+	/// CPUs of options.numaNode, if given
+	std::vector<int> nodeCpus;
 
-	/// workaround for not threadsafe Message Processors
-	boost::shared_mutex mp_mutex;	/// secures mutex map
-	std::map<IMessageProcessor *, boost::shared_ptr<boost::mutex> > mp_mutex_map;	/// holds mutex for every non-mt Message Processor
+	/// batch sizes, BOOSTSCHEDULER_BATCH_BUCKETS buckets per worker
+	std::vector<uint64_t> batchHistogram;
+
+	/// protects the queues
+	boost::shared_mutex queue_mutex;
 
 	/// map for all running timers, for cleanup mostly
 	std::map<boost::asio::deadline_timer *, boost::shared_ptr<CTimer> > timerMap;
 	std::map<boost::shared_ptr<CTimer>, boost::asio::deadline_timer *> reverseTimerMap;
 	boost::mutex timerMapMutex;
 
-	/// "cache" for message passing between schedulers
-	boost::shared_mutex dest_cache_mutex;
-	std::map<IMessageProcessor *, IMessageScheduler * > dest_cache;
-	boost::shared_mutex src_cache_mutex;
-	std::map<IMessageProcessor *, IMessageScheduler * > src_cache;
-
-	/// queue for new message processors waiting to be registered
-	boost::shared_mutex registerMutex;
-	std::map<IMessageProcessor*, boost::shared_ptr<IMessageQueue> > registerQueue;
-
-	/// queue for message processors waiting to be unregistered
-	boost::shared_mutex unregisterMutex;
-	std::list<IMessageProcessor *> unregisterQueue;
+	/// alternative to the timer maps, NULL unless the wheel backend is used
+	boost::shared_ptr<CTimerWheel> timerWheel;
 
 
 	/// handles timer events	
 	void handle_timer (boost::asio::deadline_timer * t);
 
+	/// handles expired timers of the timer wheel
+	void handle_wheel_timer (boost::shared_ptr<CTimer> & timer);
+
+	/// spawns the worker threads
+	void init (int nthreads);
+
+	/// applies the configured CPU affinity to the calling worker
+	void pinWorker (uint32_t index);
+
+	/// blocks until the scheduler runs, returns false if interrupted
+	bool waitForRun (uint32_t index);
+
 	/**
 	 * @brief processes all messages
 	 */
 	void worker_fkt (uint32_t index) throw (ESync);
 
+	/**
+	 * @brief processes all messages (work stealing mode)
+	 */
+	void worker_ws_fkt (uint32_t index) throw (ESync);
+
+	/// processes up to batchSize messages of a ready processor
+	void process (uint32_t index, const boost::shared_ptr<CProcessorQueue> & pq);
+
+	/// counts a batch of n messages processed by the given worker
+	void recordBatch (uint32_t index, uint32_t n);
+
+	/// logs the batch histogram
+	void printBatchHistogram () const;
+
+	/// hands a processor with pending messages to a worker
+	void schedule (const boost::shared_ptr<CProcessorQueue> & pq, bool urgent);
+
+	/// moves a processor waiting for bulk data to a high priority ready list
+	void promote (const boost::shared_ptr<CProcessorQueue> & pq);
+
+	/// wakes up an idle worker so it can steal work (work stealing mode)
+	void wakeIdleWorker ();
+
+	/// takes a ready processor from another worker (work stealing mode)
+	boost::shared_ptr<CProcessorQueue> steal (uint32_t index);
+
+	/// takes the next processor from a pair of ready lists
+	boost::shared_ptr<CProcessorQueue> takeReady (std::deque<boost::shared_ptr<CProcessorQueue> > & hi,
+			std::deque<boost::shared_ptr<CProcessorQueue> > & lo);
+
+	/// puts a processor back into a ready list or marks it idle
+	void release (uint32_t index, const boost::shared_ptr<CProcessorQueue> & pq);
+
+	/// calls the receiver of the message and handles its exceptions
+	void dispatch (boost::shared_ptr<IMessage> & msg);
+
+	/// calls dispatch() and updates the telemetry of the processor
+	void dispatch (const boost::shared_ptr<CProcessorQueue> & pq, boost::shared_ptr<IMessage> & msg);
+
+	/// processes a message in the calling worker if possible (run-to-completion)
+	bool directCall (const boost::shared_ptr<CProcessorQueue> & pq, boost::shared_ptr<IMessage> & msg);
+
 	/// check if there are new or outdated message processors
 //	void checkMsgProcs ();
 
@@ -172,8 +515,8 @@ private:
 #endif // NENA_MESSAGE_TRACE
 
 public:
-	CBoostSchedulerMT (CNena * na, boost::shared_ptr<boost::asio::io_service> ios, int nthreads);
-	CBoostSchedulerMT (CNena * na, boost::shared_ptr<boost::asio::io_service> ios, int nthreads, std::string name);
+	CBoostSchedulerMT (CNena * na, boost::shared_ptr<boost::asio::io_service> ios, int nthreads, const Options & options = Options());
+	CBoostSchedulerMT (CNena * na, boost::shared_ptr<boost::asio::io_service> ios, int nthreads, std::string name, const Options & options = Options());
 	virtual ~CBoostSchedulerMT ();
 	
 	/**
@@ -243,6 +586,18 @@ public:
 	 */
 	virtual void passMessage (boost::shared_ptr<IMessage> msg);
 
+	/**
+	 * @brief Append the telemetry of all message processors (if enabled)
+	 */
+	virtual void getProcessorStatistics (std::list<CProcessorStatistics> & stats);
+
+	/**
+	 * @brief Sum of the batch size histograms of all workers
+	 *
+	 * @param histogram	bucket i counts batches of 2^i to 2^(i+1)-1 messages
+	 */
+	virtual void getBatchHistogram (std::vector<uint64_t> & histogram) const;
+
 	virtual const std::string & getId () const;
 };
 
@@ -0,0 +1,106 @@
+/** @file
+ * cpuAffinity.cpp
+ *
+ * @brief CPU affinity and NUMA topology helpers (Linux)
+ *
+ * (c) 2008-2012 Institut fuer Telematik, KIT, Germany
+ */
+
+#include "cpuAffinity.h"
+
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+
+#include <pthread.h>
+#include <sched.h>
+
+using namespace std;
+
+bool CCpuAffinity::parseCpuList(const std::string & list, std::vector<int> & cpus)
+{
+	vector<int> result;
+	const char * p = list.c_str();
+
+	while (*p != '\0') {
+		if (*p == ',' || *p == ' ' || *p == '\n') {
+			p++;
+			continue;
+		}
+
+		char * end = NULL;
+		long first = strtol(p, &end, 10);
+		if (end == p || first < 0)
+			return false;
+
+		long last = first;
+		p = end;
+		if (*p == '-') {
+			p++;
+			last = strtol(p, &end, 10);
+			if (end == p || last < first)
+				return false;
+
+			p = end;
+		}
+
+		if (*p != '\0' && *p != ',' && *p != ' ' && *p != '\n')
+			return false;
+
+		for (long cpu = first; cpu <= last; cpu++)
+			result.push_back((int) cpu);
+
+	}
+
+	if (result.empty())
+		return false;
+
+	cpus.swap(result);
+	return true;
+}
+
+bool CCpuAffinity::getNodeCpus(int node, std::vector<int> & cpus)
+{
+	if (node < 0)
+		return false;
+
+	stringstream path;
+	path << "/sys/devices/system/node/node" << node << "/cpulist";
+
+	ifstream f(path.str().c_str());
+	string list;
+	if (!f.good() || !getline(f, list))
+		return false;
+
+	return parseCpuList(list, cpus);
+}
+
+bool CCpuAffinity::pinCurrentThread(const std::vector<int> & cpus)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+
+	for (vector<int>::const_iterator it = cpus.begin(); it != cpus.end(); it++) {
+		if (*it >= 0 && *it < CPU_SETSIZE)
+			CPU_SET(*it, &set);
+
+	}
+
+	if (CPU_COUNT(&set) == 0)
+		return false;
+
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+std::string CCpuAffinity::toString(const std::vector<int> & cpus)
+{
+	stringstream s;
+	for (vector<int>::const_iterator it = cpus.begin(); it != cpus.end(); it++) {
+		if (it != cpus.begin())
+			s << ",";
+
+		s << *it;
+	}
+
+	return s.str();
+}
@@ -0,0 +1,50 @@
+/** @file
+ * cpuAffinity.h
+ *
+ * @brief CPU affinity and NUMA topology helpers (Linux)
+ *
+ * (c) 2008-2012 Institut fuer Telematik, KIT, Germany
+ */
+
+#ifndef CPUAFFINITY_H_
+#define CPUAFFINITY_H_
+
+#include <string>
+#include <vector>
+
+/**
+ * @brief	Pins threads to CPUs and resolves NUMA nodes via sysfs
+ *
+ * 			We do not depend on libnuma. Memory placement relies on the
+ * 			kernel's first touch policy, i.e. memory is local to the node of
+ * 			the thread that first writes to it.
+ */
+class CCpuAffinity
+{
+public:
+	/**
+	 * @brief	Parse a Linux style cpu list, e.g. "0-3,8,10-11"
+	 *
+	 * @return	false on syntax errors
+	 */
+	static bool parseCpuList(const std::string & list, std::vector<int> & cpus);
+
+	/**
+	 * @brief	CPUs of the given NUMA node
+	 *
+	 * @return	false if the node does not exist
+	 */
+	static bool getNodeCpus(int node, std::vector<int> & cpus);
+
+	/**
+	 * @brief	Restrict the calling thread to the given CPUs
+	 *
+	 * @return	false if the affinity could not be set
+	 */
+	static bool pinCurrentThread(const std::vector<int> & cpus);
+
+	/// inverse of parseCpuList() (without ranges)
+	static std::string toString(const std::vector<int> & cpus);
+};
+
+#endif /* CPUAFFINITY_H_ */
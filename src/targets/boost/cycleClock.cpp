@@ -0,0 +1,49 @@
+/** @file
+ * cycleClock.cpp
+ *
+ * @brief Low overhead clock for telemetry
+ *
+ * (c) 2008-2012 Institut fuer Telematik, KIT, Germany
+ */
+
+#include "cycleClock.h"
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+/// calibration interval in nanoseconds
+#define CYCLECLOCK_CALIBRATION 10000000
+
+double CCycleClock::usPerCycle = 0;
+
+static boost::mutex calibrationMutex;
+
+static uint64_t monotonicNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void CCycleClock::calibrate()
+{
+	boost::lock_guard<boost::mutex> lg(calibrationMutex);
+	if (usPerCycle > 0)
+		return;
+
+#if defined(__i386__) || defined(__x86_64__)
+	uint64_t t0 = monotonicNs();
+	uint64_t c0 = now();
+
+	uint64_t t1;
+	do {
+		t1 = monotonicNs();
+	} while (t1 - t0 < CYCLECLOCK_CALIBRATION);
+
+	uint64_t c1 = now();
+
+	usPerCycle = (t1 - t0) / 1000.0 / (c1 - c0);
+#else
+	usPerCycle = 0.001;
+#endif
+}
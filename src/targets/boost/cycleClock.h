@@ -0,0 +1,50 @@
+/** @file
+ * cycleClock.h
+ *
+ * @brief Low overhead clock for telemetry
+ *
+ * (c) 2008-2012 Institut fuer Telematik, KIT, Germany
+ */
+
+#ifndef CYCLECLOCK_H_
+#define CYCLECLOCK_H_
+
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * @brief	Time stamp counter on x86, monotonic clock (ns) elsewhere
+ *
+ * 			Assumes an invariant TSC that is synchronized across cores, which
+ * 			holds for all CPUs we run on. Values are only meaningful as
+ * 			differences; call calibrate() once before converting them.
+ */
+class CCycleClock
+{
+private:
+	static double usPerCycle;
+
+public:
+	static inline uint64_t now()
+	{
+#if defined(__i386__) || defined(__x86_64__)
+		uint32_t lo, hi;
+		__asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+		return ((uint64_t) hi << 32) | lo;
+#else
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+	}
+
+	/// measure the clock rate (blocks for about 10 ms on the first call)
+	static void calibrate();
+
+	static inline double toMicroseconds(uint64_t cycles)
+	{
+		return cycles * usPerCycle;
+	}
+};
+
+#endif /* CYCLECLOCK_H_ */
@@ -43,44 +43,46 @@ CBoostNetAdapt::CBoostNetAdapt(CNena *nodeA, IMessageScheduler *sched,
 
 	recv_buffer = recvBufferPool.get();
 
-	stat_rx_bytes = 0;
-	stat_tx_bytes = 0;
-
 #ifdef BOOST_STAT_INTERVAL
 	scheduler->setTimer(new CTimer(BOOST_STAT_INTERVAL, this));
 #endif
 }
 
 CBoostNetAdapt::~CBoostNetAdapt()
-{}
+{
+	logPoolStatistics(recvBufferPool, getId());
+}
 
 /**
- * @brief	Callback after something has been received
+ * @brief	Logs the hit rate of a buffer pool
  */
-void CBoostNetAdapt::handle_receive(const boost::system::error_code& error, std::size_t bytes_transferred)
+void CBoostNetAdapt::logPoolStatistics(CSharedBufferPool& pool, const std::string& name)
 {
-	if ((bytes_transferred > 0) && (!error || error == boost::asio::error::message_size)) {
-		stat_rx_bytes += bytes_transferred;
+	map<size_t, CSharedBufferPool::Statistics> stats;
+	pool.getStatistics(stats);
 
-		if (prev != NULL) {
-			// -g costs around 25 MB/s (the following 8 lines)
-			shared_ptr<CMessageBuffer> pkt = messageBufferPool.get();
-			pkt->push_back(recv_buffer(0, bytes_transferred)); // sub buffer
-			pkt->setFrom(this);
-			pkt->setTo(prev);
-			pkt->setType(IMessage::t_incoming);
+	map<size_t, CSharedBufferPool::Statistics>::const_iterator it;
+	for (it = stats.begin(); it != stats.end(); it++) {
+		if (it->second.hits + it->second.misses == 0)
+			continue;
 
-			recv_buffer.reset(); // drop reference
-			recv_buffer = recvBufferPool.get(); // new receive buffer
+		DBG_INFO(FMT("[STAT] [BUFFERPOOL] [%1%] [%2%] hits %3% misses %4% peak %5%") % name %
+				it->first % it->second.hits % it->second.misses % it->second.peak);
+	}
+}
 
-			// -g costs around 27 MB/s (the following two lines!) - could be optimized with flow state object
-			pkt->setProperty(IMessage::p_srcLoc, getLastSender());
-			pkt->setProperty(IMessage::p_netAdapt, new CPointerValue<INetAdapt>(this));
+/**
+ * @brief	Callback after something has been received
+ */
+void CBoostNetAdapt::handle_receive(const boost::system::error_code& error, std::size_t bytes_transferred)
+{
+	if ((bytes_transferred > 0) && (!error || error == boost::asio::error::message_size)) {
+		shared_buffer_t data = recv_buffer(0, bytes_transferred); // sub buffer
 
-			if (mangle_incoming(pkt)) // in case some additional mangling is necessary
-				sendMessage(pkt); // flow state is determined later -> no chance to adapt floating packets here
+		recv_buffer.reset(); // drop reference
+		recv_buffer = recvBufferPool.get(); // new receive buffer
 
-		}
+		deliver(data);
 
 	} else if (error) {
 		DBG_WARNING(FMT("%1%: handle_receive failed with error code %2%") % getId() % error);
@@ -90,12 +92,45 @@ void CBoostNetAdapt::handle_receive(const boost::system::error_code& error, std:
 	start_receive();
 }
 
+/**
+ * @brief	Hands a received datagram to the multiplexer
+ */
+void CBoostNetAdapt::deliver(const shared_buffer_t& data)
+{
+	deliver(data, getLastSender());
+}
+
+/**
+ * @brief	Hands a received datagram from the given source to the multiplexer
+ */
+void CBoostNetAdapt::deliver(const shared_buffer_t& data, shared_ptr<CMorphableValue> srcLoc)
+{
+	stat_rx_bytes.fetch_add(data.size(), nena::memory_order_relaxed);
+
+	if (prev != NULL) {
+		// -g costs around 25 MB/s (the following 5 lines)
+		shared_ptr<CMessageBuffer> pkt = messageBufferPool.get();
+		pkt->push_back(data);
+		pkt->setFrom(this);
+		pkt->setTo(prev);
+		pkt->setType(IMessage::t_incoming);
+
+		// -g costs around 27 MB/s (the following two lines!) - could be optimized with flow state object
+		pkt->setProperty(IMessage::p_srcLoc, srcLoc);
+		pkt->setProperty(IMessage::p_netAdapt, new CPointerValue<INetAdapt>(this));
+
+		if (mangle_incoming(pkt)) // in case some additional mangling is necessary
+			sendMessage(pkt); // flow state is determined later -> no chance to adapt floating packets here
+
+	}
+}
+
 /**
  * @brief	Callback after a send operation
  */
 void CBoostNetAdapt::handle_send(boost::shared_ptr<CNetworkFrame> frame, const boost::system::error_code& error, std::size_t bytes_transferred)
 {
-	stat_tx_bytes += bytes_transferred;
+	stat_tx_bytes.fetch_add(bytes_transferred, nena::memory_order_relaxed);
 
 	if (frame->flowState.get()) { // is NULL for relayed packets and control packets w/o flow states
 		FLOWSTATE_FLOATOUT_DEC(frame->flowState, 1, "net", nena->getSysTime());
@@ -145,14 +180,11 @@ void CBoostNetAdapt::processTimer(boost::shared_ptr<IMessage> msg) throw (EUnhan
 	shared_ptr<CIntValue> rx_rate = getProperty(p_rx_rate)->cast<CIntValue>();
 	shared_ptr<CIntValue> tx_rate = getProperty(p_tx_rate)->cast<CIntValue>();
 
-	size_t rxrate = stat_rx_bytes / BOOST_STAT_INTERVAL;
-	size_t txrate = stat_tx_bytes / BOOST_STAT_INTERVAL;
+	size_t rxrate = stat_rx_bytes.exchange(0, nena::memory_order_relaxed) / BOOST_STAT_INTERVAL;
+	size_t txrate = stat_tx_bytes.exchange(0, nena::memory_order_relaxed) / BOOST_STAT_INTERVAL;
 
 	rx_rate->set(rxrate);
 	tx_rate->set(txrate);
-
-	stat_rx_bytes = 0;
-	stat_tx_bytes = 0;
 	scheduler->setTimer(new CTimer(BOOST_STAT_INTERVAL, this));
 
 //	DBG_INFO(FMT("STAT %1% tx_rate %2% rx_rate %3%") % getId() % txrate % rxrate);
@@ -14,8 +14,10 @@
 
 #include "netAdapt.h"
 #include "messageBuffer.h"
+#include "atomics.h"
 
 #include <string>
+#include <vector>
 #include <pugixml.h>
 
 #include <boost/asio.hpp>
@@ -32,8 +34,10 @@ protected:
 
 	class CNetworkFrame {
 	public:
-		boctet_t* buffer;
+		boctet_t* buffer;			///< flat copy of the frame, NULL for scatter-gather frames
 		bsize_t size;
+		message_t message;			///< keeps the fragments of scatter-gather frames alive
+		std::vector<boost::asio::const_buffer> fragments;	///< buffer sequence of scatter-gather frames
 		boost::shared_ptr<CFlowState> flowState;
 
 		CNetworkFrame(bsize_t size, boost::shared_ptr<CFlowState> flowState) :
@@ -42,6 +46,20 @@ protected:
 			assert(size > 0);
 		};
 
+		/**
+		 * @brief	Scatter-gather frame referencing the buffers of msg (no copy)
+		 */
+		CNetworkFrame(const message_t& msg, boost::shared_ptr<CFlowState> flowState) :
+			buffer(NULL), size(msg.size()), message(msg), flowState(flowState)
+		{
+			assert(size > 0);
+
+			const message_t& m = message;
+			fragments.reserve(m.length());
+			for (mlength_t i = 0; i < m.length(); i++)
+				fragments.push_back(boost::asio::const_buffer(m[i].data(), m[i].size()));
+		};
+
 		virtual ~CNetworkFrame() {
 			delete[] buffer;
 			flowState.reset();
@@ -55,14 +73,19 @@ protected:
 
 	float dropRate;											///< drop rate (for testing only)
 
-	std::size_t stat_rx_bytes; 									///< for measuring incoming bandwidth
-	std::size_t stat_tx_bytes; 									///< for measuring outgoing bandwidth
+	nena::atomic<std::size_t> stat_rx_bytes; 					///< for measuring incoming bandwidth (any receiving thread)
+	nena::atomic<std::size_t> stat_tx_bytes; 					///< for measuring outgoing bandwidth (any sending thread)
 
 	CMessageBufferPool messageBufferPool; 						///< message buffer object pool
 	CSharedBufferPool recvBufferPool; 							///< buffer pool
 
 
 
+	/**
+	 * @brief	Logs the hit rate of a buffer pool
+	 */
+	void logPoolStatistics(CSharedBufferPool& pool, const std::string& name);
+
 	/**
 	 * @brief	Start async receive
 	 *
@@ -74,6 +97,16 @@ protected:
 	 * @brief	Callback after something has been received
 	 */
 	virtual void handle_receive(const boost::system::error_code& error, std::size_t bytes_transferred);
+
+	/**
+	 * @brief	Hands a received datagram to the multiplexer
+	 */
+	void deliver(const shared_buffer_t& data);
+
+	/**
+	 * @brief	Hands a received datagram from the given source to the multiplexer
+	 */
+	void deliver(const shared_buffer_t& data, boost::shared_ptr<CMorphableValue> srcLoc);
 	
 	/**
 	 * @brief	Callback after a send operation
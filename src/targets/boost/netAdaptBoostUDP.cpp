@@ -2,12 +2,15 @@
 #include "netAdaptBoostUDP.h"
 
 #include "systemBoost.h"
+#include "cpuAffinity.h"
 
 #include "nena.h"
 #include "debug.h"
 
 #include <string>
 #include <vector>
+#include <cstring>
+#include <cerrno>
 
 #include <boost/bind.hpp>
 #include <boost/format.hpp>
@@ -16,6 +19,28 @@
 
 #define NETADAPTBOOSTUDP_NAME "netadapt://boost/udp/"
 
+/// upper limit for the batch parameter (UIO_MAXIOV would be the kernel's limit)
+#define NETADAPTBOOSTUDP_MAXBATCH 1024
+
+/// maximum number of segments per GSO send (UDP_MAX_SEGMENTS)
+#define NETADAPTBOOSTUDP_GSO_SEGMENTS 64
+
+/// maximum payload per GSO send (IPv4 datagram minus IP and UDP header)
+#define NETADAPTBOOSTUDP_GSO_BYTES 65507
+
+/// IPv4 and UDP header, a GSO segment must fit into the MTU with them
+#define NETADAPTBOOSTUDP_HEADER_BYTES 28
+
+/// default link MTU
+#define NETADAPTBOOSTUDP_MTU 1500
+
+#ifndef UIO_MAXIOV
+#define UIO_MAXIOV 1024		///< iovecs per message accepted by the kernel (linux/uio.h, clashes with sys/uio.h)
+#endif
+
+/// upper limit for the sockets parameter
+#define NETADAPTBOOSTUDP_MAXSOCKETS 64
+
 using boost::format;
 using boost::asio::ip::udp;
 using boost::shared_ptr;
@@ -26,9 +51,21 @@ using namespace std;
 
 CBoostUDPNetAdapt::CBoostUDPNetAdapt(CNena *nodeA, IMessageScheduler *sched,
 		const std::string& uri,
-		boost::shared_ptr<boost::asio::io_service> ios) :
+		boost::shared_ptr<boost::asio::io_service> ios,
+		const std::vector<int>& ioCpus) :
 	CBoostNetAdapt(nodeA, sched, uri, ios),
-	socket(*ios)
+	receivers(1, shared_ptr<CReceiver>(new CReceiver(ios))),
+	batchSize(1),
+	sendBatched(false),
+	gso(false),
+	gsoConfirmed(false),
+	mtu(NETADAPTBOOSTUDP_MTU),
+	gro(false),
+	numSockets(1),
+	receiverCpus(ioCpus)
+#ifdef __linux__
+	, flushing(false)
+#endif
 {
 	className += "::CBoostUDPNetAdapt";
 
@@ -114,6 +151,83 @@ CBoostUDPNetAdapt::CBoostUDPNetAdapt(CNena *nodeA, IMessageScheduler *sched,
 
 	}
 
+	if (nodeA->getConfig()->hasParameter(getId(), "batch", XMLFile::UINT32_T, XMLFile::VALUE)) {
+		nodeA->getConfig()->getParameter(getId(), "batch", batchSize);
+		if (batchSize < 1 || batchSize > NETADAPTBOOSTUDP_MAXBATCH) {
+			DBG_WARNING(FMT("%1%: invalid batch size %2%, batching disabled") % getId() % batchSize);
+			batchSize = 1;
+
+		}
+
+#ifndef __linux__
+		if (batchSize > 1) {
+			DBG_WARNING(FMT("%1%: recvmmsg()/sendmmsg() not available, batching disabled") % getId());
+			batchSize = 1;
+
+		}
+#endif
+
+		DBG_DEBUG(FMT("%1%: batch size %2%") % getId() % batchSize);
+
+	}
+
+	bool useGso = false;
+	if (nodeA->getConfig()->hasParameter(getId(), "gso", XMLFile::BOOL, XMLFile::VALUE))
+		nodeA->getConfig()->getParameter(getId(), "gso", useGso);
+
+	if (nodeA->getConfig()->hasParameter(getId(), "mtu", XMLFile::UINT32_T, XMLFile::VALUE)) {
+		nodeA->getConfig()->getParameter(getId(), "mtu", mtu);
+		if (mtu <= NETADAPTBOOSTUDP_HEADER_BYTES) {
+			DBG_WARNING(FMT("%1%: invalid MTU %2%, using %3%") % getId() % mtu % NETADAPTBOOSTUDP_MTU);
+			mtu = NETADAPTBOOSTUDP_MTU;
+
+		}
+
+	}
+
+	if (nodeA->getConfig()->hasParameter(getId(), "gro", XMLFile::BOOL, XMLFile::VALUE))
+		nodeA->getConfig()->getParameter(getId(), "gro", gro);
+
+	if (nodeA->getConfig()->hasParameter(getId(), "sockets", XMLFile::UINT32_T, XMLFile::VALUE)) {
+		nodeA->getConfig()->getParameter(getId(), "sockets", numSockets);
+		if (numSockets < 1 || numSockets > NETADAPTBOOSTUDP_MAXSOCKETS) {
+			DBG_WARNING(FMT("%1%: invalid number of sockets %2%, using one") % getId() % numSockets);
+			numSockets = 1;
+
+		}
+
+#ifndef SO_REUSEPORT
+		if (numSockets > 1) {
+			DBG_WARNING(FMT("%1%: SO_REUSEPORT not available, using one socket") % getId());
+			numSockets = 1;
+
+		}
+#endif
+
+	}
+
+	if (nodeA->getConfig()->hasParameter(getId(), "receiverCpus", XMLFile::STRING, XMLFile::VALUE)) {
+		string value;
+		nodeA->getConfig()->getParameter(getId(), "receiverCpus", value);
+		receiverCpus.clear();
+		if (!value.empty() && !CCpuAffinity::parseCpuList(value, receiverCpus))
+			DBG_WARNING(FMT("%1%: invalid value \"%2%\" for receiverCpus") % getId() % value);
+
+	}
+
+#ifndef __linux__
+	if (useGso || gro) {
+		DBG_WARNING(FMT("%1%: UDP segmentation offload not available, GSO/GRO disabled") % getId());
+		useGso = gro = false;
+
+	}
+#endif
+
+	gso.store(useGso, nena::memory_order_relaxed);
+
+	// switching paths later could reorder datagrams, so this stays even if GSO is turned off
+	sendBatched = batchSize > 1 || useGso;
+
 	if (configIsGood) {
 		setProperty(p_addr, new CStringValue((FMT("%1%:%2%") % ip % port).str()));
 		setConfig();
@@ -122,44 +236,443 @@ CBoostUDPNetAdapt::CBoostUDPNetAdapt(CNena *nodeA, IMessageScheduler *sched,
 }
 
 CBoostUDPNetAdapt::~CBoostUDPNetAdapt ()
-{}
+{
+	// receivers with their own thread call back into us, stop them first
+	for (size_t i = 1; i < receivers.size(); i++) {
+		receivers[i]->work.reset();
+		receivers[i]->io_service->stop();
+		if (receivers[i]->thread.get() != NULL)
+			receivers[i]->thread->join();
+
+	}
+
+	for (size_t i = 0; i < receivers.size(); i++) {
+		string name = (FMT("%1%#%2%") % getId() % i).str();
+		logPoolStatistics(receivers[i]->recvBufferPool, name);
+		logPoolStatistics(receivers[i]->groBufferPool, name);
+	}
+}
 
 /**
  * @brief	Check whether network adaptor is ready for sending/receiving data
  */
 bool CBoostUDPNetAdapt::isReady() const
 {
-	return socket.is_open();
+	return socket().is_open();
 }
 
 /**
- * @brief	Start async receive
- *
- * 			When something is received, handle_receive() will be called by boost's io_service.
+ * @brief	Start async receive on all sockets
  */
 void CBoostUDPNetAdapt::start_receive()
 {
-	assert(recv_buffer.use_count() <= 2); // pool plus recv_buffer variable
+	for (size_t i = 0; i < receivers.size(); i++)
+		start_receive(receivers[i].get());
+}
+
+/**
+ * @brief	Fills the receive buffers of a receiver and starts receiving
+ *
+ * 			Runs on the receiver's io_service, so the buffers are first touched
+ * 			by the thread that fills them later on.
+ */
+void CBoostUDPNetAdapt::init_receiver(CReceiver* r)
+{
+	r->recv_buffer = r->recvBufferPool.get();
+
+#ifdef __linux__
+	if (batchSize > 1 || gro) {
+		r->recvRing.resize(batchSize);
+		for (uint32_t k = 0; k < batchSize; k++)
+			r->recvRing[k] = getRecvBuffer(r);
+
+		r->recvHeaders.resize(batchSize);
+		r->recvVectors.resize(batchSize);
+		r->recvAddrs.resize(batchSize);
+		r->recvControl.resize(batchSize);
+	}
+#endif
+
+	start_receive(r);
+}
+
+/**
+ * @brief	Start async receive on one socket
+ *
+ * 			When something is received, handle_datagram() or
+ * 			handle_receive_batch() will be called by the receiver's io_service.
+ */
+void CBoostUDPNetAdapt::start_receive(CReceiver* r)
+{
+#ifdef __linux__
+	if (batchSize > 1 || gro) {
+		// wait for readability only, the datagrams are fetched by recvmmsg()
+		r->socket.async_receive(boost::asio::null_buffers(),
+			boost::bind (&CBoostUDPNetAdapt::handle_receive_batch, this, r,
+						 boost::asio::placeholders::error));
+		return;
+	}
+#endif
 
-	socket.async_receive_from (boost::asio::buffer((char*) ((buffer_t) recv_buffer).mutable_data(), BOOST_RECVBUFSIZE), sender,
-		boost::bind (&CBoostUDPNetAdapt::handle_receive, this,
+	assert(r->recv_buffer.use_count() <= 2); // pool plus recv_buffer variable
+
+	r->socket.async_receive_from (boost::asio::buffer((char*) ((buffer_t) r->recv_buffer).mutable_data(), BOOST_RECVBUFSIZE), r->sender,
+		boost::bind (&CBoostUDPNetAdapt::handle_datagram, this, r,
 					 boost::asio::placeholders::error,
 					 boost::asio::placeholders::bytes_transferred));
 }
 
+/**
+ * @brief	Callback after a datagram has been received in single datagram mode
+ */
+void CBoostUDPNetAdapt::handle_datagram(CReceiver* r, const boost::system::error_code& error, std::size_t bytes_transferred)
+{
+	if ((bytes_transferred > 0) && (!error || error == boost::asio::error::message_size)) {
+		shared_buffer_t data = r->recv_buffer(0, bytes_transferred); // sub buffer
+
+		r->recv_buffer.reset(); // drop reference
+		r->recv_buffer = r->recvBufferPool.get(); // new receive buffer
+
+		deliver(data, getSender(r));
+
+	} else if (error) {
+		DBG_WARNING(FMT("%1%: handle_datagram failed with error code %2%") % getId() % error);
+
+	}
+
+	start_receive(r);
+}
+
+/**
+ * @brief	Runs the io_service of a receiver with its own thread
+ */
+void CBoostUDPNetAdapt::run_receiver(CReceiver* r, uint32_t index)
+{
+	if (!receiverCpus.empty()) {
+		vector<int> cpus(1, receiverCpus[(index - 1) % receiverCpus.size()]);
+		if (!CCpuAffinity::pinCurrentThread(cpus))
+			DBG_WARNING(FMT("%1%: failed to bind receiver %2% to CPU %3%") % getId() % index % cpus[0]);
+
+	}
+
+	DBG_DEBUG(FMT("%1%: receiver starts I/O...") % getId());
+	r->io_service->run();
+	DBG_DEBUG(FMT("%1%: receiver ends I/O...") % getId());
+}
+
+#ifdef __linux__
+/**
+ * @brief	Callback when the socket became readable in batch mode
+ *
+ * 			Fetches up to batchSize datagrams with a single recvmmsg() call and
+ * 			hands them to the multiplexer back to back, so the scheduler can
+ * 			process them in one batch.
+ */
+void CBoostUDPNetAdapt::handle_receive_batch(CReceiver* r, const boost::system::error_code& error)
+{
+	if (error) {
+		DBG_WARNING(FMT("%1%: handle_receive_batch failed with error code %2%") % getId() % error);
+		start_receive(r);
+		return;
+	}
+
+	vector<shared_buffer_t>& recvRing = r->recvRing;
+	vector<struct mmsghdr>& recvHeaders = r->recvHeaders;
+	vector<struct iovec>& recvVectors = r->recvVectors;
+	vector<struct sockaddr_in>& recvAddrs = r->recvAddrs;
+
+	for (uint32_t i = 0; i < batchSize; i++) {
+		recvVectors[i].iov_base = ((buffer_t) recvRing[i]).mutable_data();
+		recvVectors[i].iov_len = recvRing[i].size();
+		recvHeaders[i].msg_hdr.msg_iov = &recvVectors[i];
+		recvHeaders[i].msg_hdr.msg_iovlen = 1;
+		recvHeaders[i].msg_hdr.msg_name = &recvAddrs[i];
+		recvHeaders[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+		recvHeaders[i].msg_hdr.msg_control = gro ? r->recvControl[i].buf : NULL;
+		recvHeaders[i].msg_hdr.msg_controllen = gro ? sizeof(CControlBuffer) : 0;
+		recvHeaders[i].msg_hdr.msg_flags = 0;
+		recvHeaders[i].msg_len = 0;
+	}
+
+	int n = recvmmsg(r->socket.native_handle(), &recvHeaders[0], batchSize, MSG_DONTWAIT, NULL);
+	if (n < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			DBG_WARNING(FMT("%1%: recvmmsg failed: %2%") % getId() % strerror(errno));
+
+		start_receive(r);
+		return;
+	}
+
+	for (int i = 0; i < n; i++) {
+		if (recvHeaders[i].msg_len == 0)
+			continue;
+
+		r->sender = udp::endpoint(boost::asio::ip::address_v4(ntohl(recvAddrs[i].sin_addr.s_addr)),
+				ntohs(recvAddrs[i].sin_port));
+		shared_ptr<CMorphableValue> srcLoc = getSender(r);
+
+		// segment size of a GRO coalesced datagram, 0 if it is a single one
+		size_t segSize = 0;
+		if (gro) {
+			struct msghdr *mh = &recvHeaders[i].msg_hdr;
+			for (struct cmsghdr *cm = CMSG_FIRSTHDR(mh); cm != NULL; cm = CMSG_NXTHDR(mh, cm)) {
+				if (cm->cmsg_level == IPPROTO_UDP && cm->cmsg_type == UDP_GRO) {
+					int gs;
+					memcpy(&gs, CMSG_DATA(cm), sizeof(int));
+					segSize = gs;
+				}
+			}
+		}
+
+		shared_buffer_t data = recvRing[i](0, recvHeaders[i].msg_len); // sub buffer
+
+		recvRing[i].reset(); // drop reference
+		recvRing[i] = getRecvBuffer(r); // refill slot
+
+		if (segSize == 0 || segSize >= data.size()) {
+			deliver(data, srcLoc);
+
+		} else {
+			// split into the original datagrams, all share the receive buffer
+			for (size_t off = 0; off < data.size(); off += segSize)
+				deliver(data(off, min(segSize, data.size() - off)), srcLoc);
+
+		}
+	}
+
+	start_receive(r);
+}
+
+/**
+ * @brief	Returns an empty buffer for the receive ring of a receiver
+ */
+shared_buffer_t CBoostUDPNetAdapt::getRecvBuffer(CReceiver* r)
+{
+	return gro ? r->groBufferPool.get() : r->recvBufferPool.get();
+}
+
+/**
+ * @brief	Queue a frame for the next sendmmsg() call
+ *
+ * 			The first frame of a burst schedules flush_send() on the io_service,
+ * 			all frames queued until it runs go out together. Only one flush is
+ * 			under way at any time, so the datagrams leave in the queued order.
+ */
+void CBoostUDPNetAdapt::queue_send(shared_ptr<CNetworkFrame> frame, const udp::endpoint& target)
+{
+	bool schedule;
+	{
+		boost::lock_guard<boost::mutex> lock(sendMutex);
+		sendQueue.push_back(CSendRequest(frame, target));
+		schedule = !flushing;
+		flushing = true;
+	}
+
+	if (schedule)
+		io_service->post(boost::bind(&CBoostUDPNetAdapt::flush_send, this));
+}
+
+/**
+ * @brief	Send all queued frames with as few sendmmsg() calls as possible
+ *
+ * 			With GSO, consecutive frames to the same target are sent as one
+ * 			UDP_SEGMENT datagram which the kernel (or the NIC) splits again.
+ * 			Frames the kernel did not take (full send buffer) stay at the head
+ * 			of the queue until the socket is writable again.
+ */
+void CBoostUDPNetAdapt::flush_send()
+{
+	{
+		boost::lock_guard<boost::mutex> lock(sendMutex);
+		sendPending.insert(sendPending.end(), sendQueue.begin(), sendQueue.end());
+		sendQueue.clear();
+	}
+
+	vector<CSendRequest>& queue = sendPending;
+
+	// only the flusher uses these, flushes never overlap
+	vector<size_t> groupEnd;
+	vector<struct mmsghdr> sendHeaders;
+	vector<struct iovec> sendVectors;
+	vector<CControlBuffer> sendControl;
+
+	bool blocked = false;
+	bool plain = false;		// resend the current batch without UDP_SEGMENT
+	size_t next = 0;
+	while (next < queue.size()) {
+		bool segment = !plain && gso.load(nena::memory_order_relaxed);
+
+		// collect up to batchSize datagrams, with GSO each one may carry a
+		// group of segments to the same target (all but the last of equal size)
+		groupEnd.clear();
+		size_t end = next;
+		size_t fragments = 0;
+		while (groupEnd.size() < batchSize && end < queue.size()) {
+			size_t first = end;
+			size_t segSize = queue[first].first->size;
+			size_t total = 0;
+			size_t iovecs = 0;
+
+			do {
+				iovecs += queue[end].first->fragments.size();
+				total += queue[end].first->size;
+				end++;
+
+			} while (segment && end < queue.size() &&
+					segSize + NETADAPTBOOSTUDP_HEADER_BYTES <= mtu &&
+					end - first < NETADAPTBOOSTUDP_GSO_SEGMENTS &&
+					queue[end - 1].first->size == segSize &&
+					queue[end].first->size <= segSize &&
+					total + queue[end].first->size <= NETADAPTBOOSTUDP_GSO_BYTES &&
+					iovecs + queue[end].first->fragments.size() <= UIO_MAXIOV &&
+					queue[end].second == queue[first].second);
+
+			fragments += iovecs;
+			groupEnd.push_back(end);
+		}
+
+		size_t count = groupEnd.size();
+
+		// iovecs are referenced by pointer, so do not reallocate while filling
+		sendVectors.resize(fragments);
+		sendHeaders.resize(count);
+		sendControl.resize(count);
+
+		size_t v = 0;
+		size_t f = next;
+		for (size_t i = 0; i < count; i++) {
+			udp::endpoint& target = queue[f].second;
+			size_t segments = groupEnd[i] - f;
+
+			memset(&sendHeaders[i], 0, sizeof(struct mmsghdr));
+			sendHeaders[i].msg_hdr.msg_iov = &sendVectors[v];
+			sendHeaders[i].msg_hdr.msg_name = target.data();
+			sendHeaders[i].msg_hdr.msg_namelen = target.size();
+
+			if (segments > 1) {
+				memset(&sendControl[i], 0, sizeof(CControlBuffer));
+				sendHeaders[i].msg_hdr.msg_control = sendControl[i].buf;
+				sendHeaders[i].msg_hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+
+				struct cmsghdr *cm = CMSG_FIRSTHDR(&sendHeaders[i].msg_hdr);
+				cm->cmsg_level = IPPROTO_UDP;
+				cm->cmsg_type = UDP_SEGMENT;
+				cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+				uint16_t segSize = queue[f].first->size;
+				memcpy(CMSG_DATA(cm), &segSize, sizeof(uint16_t));
+			}
+
+			for (; f < groupEnd[i]; f++) {
+				CNetworkFrame& frame = *queue[f].first;
+				for (size_t k = 0; k < frame.fragments.size(); k++, v++) {
+					sendVectors[v].iov_base = const_cast<void *>(boost::asio::buffer_cast<const void *>(frame.fragments[k]));
+					sendVectors[v].iov_len = boost::asio::buffer_size(frame.fragments[k]);
+				}
+			}
+
+			sendHeaders[i].msg_hdr.msg_iovlen = &sendVectors[0] + v - sendHeaders[i].msg_hdr.msg_iov;
+		}
+
+		int n = sendmmsg(socket().native_handle(), &sendHeaders[0], count, MSG_DONTWAIT);
+		if (n <= 0) {
+			int err = n < 0 ? errno : EAGAIN;
+			bool segmented = groupEnd[0] - next > 1;
+
+			if (segmented && err == EIO && !gsoConfirmed) {
+				// device or kernel without UDP segmentation offload
+				DBG_WARNING(FMT("%1%: UDP_SEGMENT not supported (%2%), GSO disabled") % getId() % strerror(err));
+				gso.store(false, nena::memory_order_relaxed);
+
+			} else if (segmented && (err == EIO || err == EINVAL)) {
+				// GSO works, but not for this datagram (e.g. a smaller path MTU)
+				DBG_DEBUG(FMT("%1%: UDP_SEGMENT send failed (%2%), sending segments one by one") % getId() % strerror(err));
+				plain = true;
+
+			} else if (err == EAGAIN || err == EWOULDBLOCK) {
+				blocked = true;
+				break;
+
+			} else {
+				// the first datagram was refused, drop it and go on with the rest
+				DBG_WARNING(FMT("%1%: sendmmsg failed: %2%") % getId() % strerror(err));
+				boost::system::error_code error(err, boost::system::system_category());
+				for (; next < groupEnd[0]; next++)
+					handle_send(queue[next].first, error, 0);
+
+			}
+
+			continue;
+		}
+
+		plain = false;
+
+		for (int i = 0; i < n; i++) {
+			if (groupEnd[i] - next == 1) {
+				handle_send(queue[next].first, boost::system::error_code(), sendHeaders[i].msg_len);
+				next++;
+
+			} else {
+				gsoConfirmed = true;
+				for (; next < groupEnd[i]; next++)
+					handle_send(queue[next].first, boost::system::error_code(), queue[next].first->size);
+
+			}
+		}
+	}
+
+	queue.erase(queue.begin(), queue.begin() + next);
+
+	if (blocked) {
+		// keep the remaining frames in front of newly queued ones and let
+		// asio wait for the socket to drain
+		socket().async_send(boost::asio::null_buffers(),
+			boost::bind(&CBoostUDPNetAdapt::handle_writable, this,
+						boost::asio::placeholders::error));
+		return;
+	}
+
+	bool more;
+	{
+		boost::lock_guard<boost::mutex> lock(sendMutex);
+		more = !sendQueue.empty();
+		flushing = more;
+	}
+
+	// frames queued meanwhile, give other handlers a chance first
+	if (more)
+		io_service->post(boost::bind(&CBoostUDPNetAdapt::flush_send, this));
+}
+
+/**
+ * @brief	Callback when the socket became writable again
+ */
+void CBoostUDPNetAdapt::handle_writable(const boost::system::error_code& error)
+{
+	if (error == boost::asio::error::operation_aborted)
+		return; // socket closed
+
+	if (error)
+		DBG_WARNING(FMT("%1%: waiting for the socket failed with error code %2%") % getId() % error);
+
+	flush_send();
+}
+#endif
+
 /**
  * @brief	Additional packet mangling of child classes (optional)
  */
 bool CBoostUDPNetAdapt::mangle_incoming(boost::shared_ptr<CMessageBuffer>& pkt)
 {
-	unsigned long v4addr = sender.address().to_v4().to_ulong();
+	// the receiving socket may be any of the receivers, take the sender from the message
+	shared_ptr<ipv4::CLocatorValue> src = pkt->getProperty<ipv4::CLocatorValue>(IMessage::p_srcLoc);
+	unsigned long v4addr = src->getAddr();
 	// check sender first (drop all packets not coming from an allowed host)
 	if (!allowedHosts.empty()) {
 		map<uint32_t, bool>::iterator isAllowed = allowedHosts.find(v4addr);
 		if ((isAllowed == allowedHosts.end()) || !(isAllowed->second)) {
 			// host not found or disabled
 			DBG_WARNING(FMT("%1%: Received packet from disallowed host %2%") %
-					getId() % sender.address().to_string());
+					getId() % src->addrToStr());
 
 		} else {
 			return true;
@@ -168,7 +681,7 @@ bool CBoostUDPNetAdapt::mangle_incoming(boost::shared_ptr<CMessageBuffer>& pkt)
 
 	} else {
 		DBG_WARNING(FMT("%1%: no allowed hosts found. Dropping packet from %2%:%3%...") %
-				getId() % sender.address().to_string() % sender.port());
+				getId() % src->addrToStr() % src->getPort());
 
 	}
 
@@ -190,9 +703,8 @@ void CBoostUDPNetAdapt::processOutgoing(boost::shared_ptr<IMessage> msg) throw (
 		throw EUnhandledMessage();
 	}
 
-	bsize_t size = pkt->size();
-	shared_ptr<CNetworkFrame> frame(new CNetworkFrame(size, msg->getFlowState()));
-	pkt->getBuffer().read(frame->buffer);
+	// the fragments are handed to sendmsg() directly, no need to linearize
+	shared_ptr<CNetworkFrame> frame(new CNetworkFrame(pkt->getBuffer(), msg->getFlowState()));
 
 	// determine target
 	list<shared_ptr<CLocatorValue> > ll;
@@ -223,7 +735,14 @@ void CBoostUDPNetAdapt::processOutgoing(boost::shared_ptr<IMessage> msg) throw (
 			boost::asio::ip::address::from_string(lv->addrToStr()), lv->getPort());
 
 		if (dropRate == 0 || nena->getSys()->random() > dropRate) {
-			socket.async_send_to (boost::asio::buffer((char*) frame->buffer, frame->size), target,
+#ifdef __linux__
+			if (sendBatched) {
+				queue_send(frame, target);
+				continue;
+			}
+#endif
+
+			socket().async_send_to (frame->fragments, target,
 								  boost::bind (&CBoostUDPNetAdapt::handle_send, this, frame,
 											   boost::asio::placeholders::error,
 											   boost::asio::placeholders::bytes_transferred));
@@ -242,7 +761,15 @@ void CBoostUDPNetAdapt::processOutgoing(boost::shared_ptr<IMessage> msg) throw (
  */
 boost::shared_ptr<CMorphableValue> CBoostUDPNetAdapt::getLastSender()
 {
-	shared_ptr<ipv4::CLocatorValue> s(new ipv4::CLocatorValue(sender.address().to_v4().to_ulong(), sender.port()));
+	return getSender(receivers[0].get());
+}
+
+/**
+ * @brief	Returns the locator of the last sender of a receiver
+ */
+boost::shared_ptr<CMorphableValue> CBoostUDPNetAdapt::getSender(const CReceiver* r) const
+{
+	shared_ptr<ipv4::CLocatorValue> s(new ipv4::CLocatorValue(r->sender.address().to_v4().to_ulong(), r->sender.port()));
 	return s;
 }
 
@@ -252,7 +779,7 @@ boost::shared_ptr<CMorphableValue> CBoostUDPNetAdapt::getLastSender()
  */
 void CBoostUDPNetAdapt::setConfig()
 {
-	if (socket.is_open()) {
+	if (socket().is_open()) {
 		DBG_ERROR(FMT("%1%: Socket already bound, cannot set configuration") % getId());
 
 	} else {
@@ -277,11 +804,31 @@ void CBoostUDPNetAdapt::setConfig()
 
 		setProperty(p_name, new CStringValue(getId()));
 
-		socket.open(udp::v4());
-		socket.bind(udp::endpoint(boost::asio::ip::address::from_string(ip), port));
+		// additional sockets on the same address, the kernel spreads the flows among them
+		for (uint32_t i = 1; i < numSockets; i++) {
+			shared_ptr<boost::asio::io_service> ios(new boost::asio::io_service());
+			receivers.push_back(shared_ptr<CReceiver>(new CReceiver(ios)));
+		}
+
+		for (size_t i = 0; i < receivers.size(); i++) {
+			udp::socket& socket = receivers[i]->socket;
+
+			socket.open(udp::v4());
+
+#ifdef SO_REUSEPORT
+			if (numSockets > 1) {
+				int on = 1;
+				if (setsockopt(socket.native_handle(), SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0)
+					DBG_WARNING(FMT("%1%: cannot set SO_REUSEPORT: %2%") % getId() % strerror(errno));
 
-		socket.set_option(udp::socket::broadcast(true));
-		socket.set_option(udp::socket::reuse_address(true));
+			}
+#endif
+
+			socket.bind(udp::endpoint(boost::asio::ip::address::from_string(ip), port));
+
+			socket.set_option(udp::socket::broadcast(true));
+			socket.set_option(udp::socket::reuse_address(true));
+		}
 
 		/*
 		 * Since we receive a lot of packets per video frame (~200/300kB), we need
@@ -301,7 +848,30 @@ void CBoostUDPNetAdapt::setConfig()
 	//	socket.set_option(boost::asio::socket_base::receive_buffer_size(BOOST_SYSRECVBUFSIZE));
 	//	socket.set_option(boost::asio::socket_base::send_buffer_size(BOOST_SYSSENDBUFSIZE));
 
-		start_receive();
+#ifdef __linux__
+		for (size_t i = 0; gro && i < receivers.size(); i++) {
+			int on = 1;
+			if (setsockopt(receivers[i]->socket.native_handle(), IPPROTO_UDP, UDP_GRO, &on, sizeof(on)) != 0) {
+				DBG_WARNING(FMT("%1%: UDP_GRO not supported (%2%), GRO disabled") % getId() % strerror(errno));
+				gro = false;
+
+			}
+		}
+#endif
+
+		for (size_t i = 0; i < receivers.size(); i++) {
+			CReceiver* r = receivers[i].get();
+			r->io_service->post(boost::bind(&CBoostUDPNetAdapt::init_receiver, this, r));
+		}
+
+		for (size_t i = 1; i < receivers.size(); i++) {
+			CReceiver* r = receivers[i].get();
+			r->work.reset(new boost::asio::io_service::work(*r->io_service));
+			r->thread.reset(new boost::thread(boost::bind(&CBoostUDPNetAdapt::run_receiver, this, r, static_cast<uint32_t>(i))));
+		}
+
+		if (receivers.size() > 1)
+			DBG_INFO(FMT("%1%: receiving on %2% sockets") % getId() % receivers.size());
 
 	}
 }
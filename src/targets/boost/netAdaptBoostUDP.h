@@ -14,6 +14,30 @@
 
 #include "netAdaptBoost.h"
 #include "ipv4.h"
+#include "atomics.h"
+
+#include <vector>
+#include <utility>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103		///< from linux/udp.h (4.18), missing in older libc headers
+#endif
+
+#ifndef UDP_GRO
+#define UDP_GRO 104			///< from linux/udp.h (5.0)
+#endif
+#endif
+
+/// receive buffer size with GRO, the kernel coalesces up to 64 kB
+#define NETADAPTBOOSTUDP_GROBUFSIZE 65536
 
 
 /*****************************************************************************/
@@ -21,14 +45,137 @@
 class CBoostUDPNetAdapt : public CBoostNetAdapt
 {
 protected:
-	boost::asio::ip::udp::socket socket;		///< socket we want to use
-	boost::asio::ip::udp::endpoint sender;		///< this is where the last message came from
-	std::map<uint32_t, bool> allowedHosts;		///< list of allowed hosts
+#ifdef __linux__
+	/// ancillary data of a single int (UDP_GRO) or uint16_t (UDP_SEGMENT)
+	union CControlBuffer {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	};
+#endif
 
 	/**
-	 * @brief	Start async receive
+	 * @brief	Receive state of one socket
 	 *
-	 * 			When something is received, handle_receive() will be called by boost's io_service.
+	 * 			The first receiver runs on the system's io_service and is also
+	 * 			used for sending. With SO_REUSEPORT, the others run on their own
+	 * 			io_service and thread, pinned to receiverCpus. Each receiver has
+	 * 			its own buffer pools, which are only filled by the thread running
+	 * 			its io_service.
+	 *
+	 * 			All receivers hand their packets to the same net adapt, so they
+	 * 			share its scheduler. More sockets spread the system call and copy
+	 * 			load, the processing behind the net adapt is not spread by them.
+	 */
+	class CReceiver
+	{
+	public:
+		boost::shared_ptr<boost::asio::io_service> io_service;
+		boost::asio::ip::udp::socket socket;
+		boost::asio::ip::udp::endpoint sender;		///< this is where the last message came from
+		shared_buffer_t recv_buffer;				///< incoming buffer of the single datagram mode
+
+		CSharedBufferPool recvBufferPool;			///< receive buffers for single datagrams
+		CSharedBufferPool groBufferPool;			///< receive buffers large enough for coalesced datagrams
+
+		boost::shared_ptr<boost::asio::io_service::work> work;	///< keeps a private io_service running
+		boost::shared_ptr<boost::thread> thread;				///< runs a private io_service
+
+#ifdef __linux__
+		/// receive ring, one pooled buffer per slot
+		std::vector<shared_buffer_t> recvRing;
+		std::vector<struct mmsghdr> recvHeaders;
+		std::vector<struct iovec> recvVectors;
+		std::vector<struct sockaddr_in> recvAddrs;
+		std::vector<CControlBuffer> recvControl;
+#endif
+
+		CReceiver(boost::shared_ptr<boost::asio::io_service> ios) :
+			io_service(ios), socket(*ios),
+			recvBufferPool(BOOST_RECVBUFSIZE),
+			groBufferPool(NETADAPTBOOSTUDP_GROBUFSIZE)
+		{}
+	};
+
+	std::vector<boost::shared_ptr<CReceiver> > receivers;	///< at least one, receivers[0] also sends
+	std::map<uint32_t, bool> allowedHosts;		///< list of allowed hosts
+
+	uint32_t batchSize;		///< datagrams per recvmmsg()/sendmmsg() call, 1 disables batching
+	bool sendBatched;		///< frames go through queue_send(), fixed once configured
+	nena::atomic<bool> gso;	///< coalesce segments to the same target with UDP_SEGMENT, cleared by the flusher
+	bool gsoConfirmed;		///< a UDP_SEGMENT send succeeded, so the device supports it (flusher only)
+	uint32_t mtu;			///< link MTU, larger segments are not coalesced
+	bool gro;				///< accept UDP_GRO coalesced datagrams and split them up again
+	uint32_t numSockets;	///< number of SO_REUSEPORT sockets bound to the same address
+	std::vector<int> receiverCpus;	///< receiver i > 0 runs on CPU i-1 of this list, empty for no pinning
+
+	/// socket used for sending
+	inline boost::asio::ip::udp::socket& socket() const
+	{
+		return receivers[0]->socket;
+	}
+
+	/**
+	 * @brief	Fills the receive buffers of a receiver and starts receiving,
+	 * 			runs on the receiver's io_service
+	 */
+	void init_receiver(CReceiver* r);
+
+	/**
+	 * @brief	Start async receive on one socket
+	 */
+	void start_receive(CReceiver* r);
+
+	/**
+	 * @brief	Callback after a datagram has been received in single datagram mode
+	 */
+	void handle_datagram(CReceiver* r, const boost::system::error_code& error, std::size_t bytes_transferred);
+
+	/**
+	 * @brief	Runs the io_service of receiver index > 0 with its own thread
+	 */
+	void run_receiver(CReceiver* r, uint32_t index);
+
+	/**
+	 * @brief	Returns the locator of the last sender of a receiver
+	 */
+	boost::shared_ptr<CMorphableValue> getSender(const CReceiver* r) const;
+
+#ifdef __linux__
+	typedef std::pair<boost::shared_ptr<CNetworkFrame>, boost::asio::ip::udp::endpoint> CSendRequest;
+
+	boost::mutex sendMutex;				///< protects sendQueue and flushing
+	std::vector<CSendRequest> sendQueue;	///< frames waiting for the next sendmmsg()
+	bool flushing;						///< a flush_send() is scheduled or waiting for the socket
+	std::vector<CSendRequest> sendPending;	///< frames the kernel did not take yet, owned by the flusher
+
+	/**
+	 * @brief	Callback when the socket became readable in batch mode
+	 */
+	void handle_receive_batch(CReceiver* r, const boost::system::error_code& error);
+
+	/**
+	 * @brief	Returns an empty buffer for the receive ring of a receiver
+	 */
+	shared_buffer_t getRecvBuffer(CReceiver* r);
+
+	/**
+	 * @brief	Queue a frame for the next sendmmsg() call
+	 */
+	void queue_send(boost::shared_ptr<CNetworkFrame> frame, const boost::asio::ip::udp::endpoint& target);
+
+	/**
+	 * @brief	Send all queued frames with as few sendmmsg() calls as possible
+	 */
+	void flush_send();
+
+	/**
+	 * @brief	Callback when the socket became writable again
+	 */
+	void handle_writable(const boost::system::error_code& error);
+#endif
+
+	/**
+	 * @brief	Start async receive on all sockets
 	 */
 	virtual void start_receive();
 	
@@ -43,9 +190,13 @@ protected:
 	virtual boost::shared_ptr<CMorphableValue> getLastSender();
 		
 public:
+	/**
+	 * @param ioCpus	CPUs of the system's I/O thread, default for receiverCpus
+	 */
 	CBoostUDPNetAdapt(CNena *nodeA, IMessageScheduler *sched,
 			const std::string& uri,
-			boost::shared_ptr<boost::asio::io_service> ios);
+			boost::shared_ptr<boost::asio::io_service> ios,
+			const std::vector<int>& ioCpus = std::vector<int>());
 	virtual ~CBoostUDPNetAdapt ();
 
 	/**
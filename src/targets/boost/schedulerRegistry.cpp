@@ -0,0 +1,45 @@
+/** @file
+ * schedulerRegistry.cpp
+ *
+ * @brief Global map of message processors to their schedulers
+ *
+ * (c) 2008-2012 Institut fuer Telematik, KIT, Germany
+ */
+
+#include "schedulerRegistry.h"
+
+#include <boost/thread/locks.hpp>
+
+using boost::shared_mutex;
+using boost::shared_lock;
+using boost::unique_lock;
+
+CSchedulerRegistry & CSchedulerRegistry::instance ()
+{
+	static CSchedulerRegistry registry;
+	return registry;
+}
+
+void CSchedulerRegistry::insert (IMessageProcessor * proc, IMessageScheduler * sched)
+{
+	CShard & s = shard (proc);
+	unique_lock<shared_mutex> lock (s.mutex);
+	s.map[proc] = sched;
+}
+
+void CSchedulerRegistry::erase (IMessageProcessor * proc, IMessageScheduler * sched)
+{
+	CShard & s = shard (proc);
+	unique_lock<shared_mutex> lock (s.mutex);
+	boost::unordered_map<IMessageProcessor *, IMessageScheduler *>::iterator it = s.map.find (proc);
+	if (it != s.map.end () && it->second == sched)
+		s.map.erase (it);
+}
+
+IMessageScheduler * CSchedulerRegistry::lookup (IMessageProcessor * proc)
+{
+	CShard & s = shard (proc);
+	shared_lock<shared_mutex> lock (s.mutex);
+	boost::unordered_map<IMessageProcessor *, IMessageScheduler *>::const_iterator it = s.map.find (proc);
+	return it != s.map.end () ? it->second : NULL;
+}
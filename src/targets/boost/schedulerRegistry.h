@@ -0,0 +1,64 @@
+/** @file
+ * schedulerRegistry.h
+ *
+ * @brief Global map of message processors to their schedulers
+ *
+ * (c) 2008-2012 Institut fuer Telematik, KIT, Germany
+ */
+
+#ifndef SCHEDULERREGISTRY_H_
+#define SCHEDULERREGISTRY_H_
+
+#include "messages.h"
+
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/unordered_map.hpp>
+
+#include <stdint.h>
+
+/// number of independently locked shards (power of two)
+#define SCHEDULERREGISTRY_SHARDS 16
+
+/**
+ * @brief	Maps every registered message processor to its scheduler
+ *
+ * 			Updated by the schedulers on register/unregister, so lookups
+ * 			never need to ask the schedulers. The map is split into shards
+ * 			with their own lock; lookups only take a shared lock on one shard.
+ */
+class CSchedulerRegistry
+{
+private:
+	class CShard
+	{
+	public:
+		boost::shared_mutex mutex;
+		boost::unordered_map<IMessageProcessor *, IMessageScheduler *> map;
+		char pad[64];		///< keep the locks of neighbouring shards in separate cache lines
+	};
+
+	CShard shards[SCHEDULERREGISTRY_SHARDS];
+
+	inline CShard & shard (IMessageProcessor * proc)
+	{
+		uintptr_t h = (uintptr_t) proc;
+		h ^= h >> 4;
+		h ^= h >> 9;
+		return shards[h & (SCHEDULERREGISTRY_SHARDS - 1)];
+	}
+
+public:
+	/// registry shared by all schedulers of the process
+	static CSchedulerRegistry & instance ();
+
+	/// set the scheduler of a processor
+	void insert (IMessageProcessor * proc, IMessageScheduler * sched);
+
+	/// remove a processor if it still belongs to the given scheduler
+	void erase (IMessageProcessor * proc, IMessageScheduler * sched);
+
+	/// returns the scheduler of a processor or NULL if it is unknown
+	IMessageScheduler * lookup (IMessageProcessor * proc);
+};
+
+#endif /* SCHEDULERREGISTRY_H_ */
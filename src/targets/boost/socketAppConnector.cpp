@@ -128,7 +128,7 @@ void CSocketAppConnector::handle_header(const boost::system::error_code& error,
 		//if (header[1] == 0)
 		//DBG_FAIL(FMT("%1%: received message of length 0") % className);
 
-		buffer = shared_buffer_t(header[1]);
+		buffer = shared_buffer_t::with_headroom(header[1], MESSAGEBUFFER_HEADROOM);
 		//memset(buffer, 0, header[1]);
 
 		bytes_left = header[1];
@@ -23,6 +23,8 @@
 #include "socketAppConnector.h"
 #include "memAppConnector.h"
 #include "syncBoost.h"
+#include "cpuAffinity.h"
+#include "schedulerRegistry.h"
 
 #include <iostream>
 #include <boost/asio.hpp>
@@ -237,6 +239,11 @@ CSystemBoost::~CSystemBoost()
 void CSystemBoost::io_run()
 {
 	DBG_DEBUG("CSystemBoost: starts I/O...");
+
+	/// net adapts receive (and allocate their buffers) in this thread
+	if (!ioCpus.empty() && !CCpuAffinity::pinCurrentThread(ioCpus))
+		DBG_WARNING(FMT("CSystemBoost: failed to bind I/O thread to CPU(s) %1%") % CCpuAffinity::toString(ioCpus));
+
 	io->run();
 	DBG_DEBUG("CSystemBoost: ends I/O...");
 }
@@ -296,7 +303,7 @@ void CSystemBoost::initNetAdapts(CNena * nodearch, IMessageScheduler * sched)
 		vector<vector<string> >::const_iterator it;
 		for (it = nas.begin(); it != nas.end(); it++) {
 			if (it->at(0) == "netadapt://boost/udp/" || it->at(0) == "netadapt://boost/udp") {
-				na = shared_ptr<INetAdapt>(new CBoostUDPNetAdapt(nodearch, sched, it->at(1), io));
+				na = shared_ptr<INetAdapt>(new CBoostUDPNetAdapt(nodearch, sched, it->at(1), io, ioCpus));
 				if (na->isReady()) {
 					netAdapts.push_back(na);
 
@@ -331,7 +338,7 @@ void CSystemBoost::initNetAdapts(CNena * nodearch, IMessageScheduler * sched)
 
 	} else {
 		// instantiate a default net adapt
-		na_udp = shared_ptr<CBoostUDPNetAdapt>(new CBoostUDPNetAdapt(nodearch, sched, std::string(), io));
+		na_udp = shared_ptr<CBoostUDPNetAdapt>(new CBoostUDPNetAdapt(nodearch, sched, std::string(), io, ioCpus));
 		na_udp->setArchId("architecture://edu.kit.tm/itm/simpleArch");
 		na_udp->setProperty(INetAdapt::p_archid, new CStringValue(na_udp->getArchId()));
 		na_udp->setProperty(INetAdapt::p_addr, new CStringValue((FMT("0.0.0.0:%1%") % port).str()));
@@ -419,15 +426,8 @@ IMessageScheduler * CSystemBoost::getMainScheduler() const
 
 IMessageScheduler * CSystemBoost::lookupScheduler(IMessageProcessor * proc)
 {
-	boost::shared_lock<shared_mutex> sl(s_mutex);
-	list<shared_ptr<IMessageScheduler> >::const_iterator it;
-
-	for (it = schedulers.begin(); it != schedulers.end(); it++) {
-		if ((*it)->hasMessageProcessor(proc))
-			return it->get();
-	}
-
-	return NULL;
+	/// all our schedulers keep the registry up to date
+	return CSchedulerRegistry::instance().lookup(proc);
 }
 
 IMessageScheduler * CSystemBoost::getSchedulerByName(std::string name)
@@ -457,7 +457,36 @@ void CSystemBoost::initSchedulers(CNena * na)
 	if (nthreads != 0)
 		n = nthreads;
 
-	s.reset(new CBoostSchedulerMT(nodearch, io, n));
+	/// options shared by all schedulers
+	const char * keys[] = { "schedulerMode", "messageQueue", "batchSize", "timerBackend", "timerTick", "cpus", "numaNode", "directCallDepth", "priorities", "priorityWeight", "telemetry", NULL };
+	for (int i = 0; keys[i] != NULL; i++) {
+		if (nodearch->getConfig()->hasParameter(systemId, keys[i], XMLFile::STRING, XMLFile::VALUE)) {
+			string value;
+			nodearch->getConfig()->getParameter(systemId, keys[i], value);
+			if (!schedulerOptions.set(keys[i], value))
+				DBG_WARNING(FMT("CSystemBoost: invalid value \"%1%\" for %2%") % value % keys[i]);
+
+		}
+	}
+
+	/// affinity of the i/o thread, should match the schedulers of the net adapts
+	if (nodearch->getConfig()->hasParameter(systemId, "ioCpus", XMLFile::STRING, XMLFile::VALUE)) {
+		string value;
+		nodearch->getConfig()->getParameter(systemId, "ioCpus", value);
+		if (!value.empty() && !CCpuAffinity::parseCpuList(value, ioCpus))
+			DBG_WARNING(FMT("CSystemBoost: invalid value \"%1%\" for ioCpus") % value);
+
+	}
+
+	if (ioCpus.empty() && nodearch->getConfig()->hasParameter(systemId, "ioNumaNode", XMLFile::STRING, XMLFile::VALUE)) {
+		string value;
+		nodearch->getConfig()->getParameter(systemId, "ioNumaNode", value);
+		if (!value.empty() && !CCpuAffinity::getNodeCpus(atoi(value.c_str()), ioCpus))
+			DBG_WARNING(FMT("CSystemBoost: unknown NUMA node \"%1%\" for ioNumaNode") % value);
+
+	}
+
+	s.reset(new CBoostSchedulerMT(nodearch, io, n, "main", getSchedulerOptions("main")));
 
 	schedulers.push_back(s);
 
@@ -465,18 +494,48 @@ void CSystemBoost::initSchedulers(CNena * na)
 
 	/// init user defined schedulers
 
-	if (nodearch->getConfig()->hasParameter(systemId, "schedulers")) {
+	if (nodearch->getConfig()->hasParameter(systemId, "schedulerList", XMLFile::STRING, XMLFile::LIST)) {
 		vector<string> schedulerList;
 		nodearch->getConfig()->getParameterList(systemId, "schedulerList", schedulerList);
 
 		for (vector<string>::const_iterator it = schedulerList.begin(); it != schedulerList.end(); it++) {
-			s.reset(new CBoostSchedulerMT(nodearch, io, n, *it));
+			s.reset(new CBoostSchedulerMT(nodearch, io, n, *it, getSchedulerOptions(*it)));
 			schedulers.push_back(s);
 		}
 
 	}
 }
 
+/**
+ * @brief	Returns the options for a scheduler
+ *
+ * 			Starts from the system wide defaults and applies the rows of the
+ * 			schedulerOptions table (scheduler name, option, value) matching the
+ * 			given name.
+ */
+CBoostSchedulerMT::Options CSystemBoost::getSchedulerOptions(const std::string & name)
+{
+	CBoostSchedulerMT::Options opts = schedulerOptions;
+
+	if (nodearch->getConfig()->hasParameter(systemId, "schedulerOptions", XMLFile::STRING, XMLFile::TABLE)) {
+		vector<vector<string> > table;
+		nodearch->getConfig()->getParameterTable(systemId, "schedulerOptions", table);
+
+		vector<vector<string> >::const_iterator it;
+		for (it = table.begin(); it != table.end(); it++) {
+			if (it->size() < 3 || it->at(0) != name)
+				continue;
+
+			if (!opts.set(it->at(1), it->at(2)))
+				DBG_WARNING(FMT("CSystemBoost: invalid scheduler option %1%=%2% for %3%") % it->at(1) % it->at(2) % name);
+
+		}
+
+	}
+
+	return opts;
+}
+
 /**
  * @brief	Returns a system-specific scheduler.
  */
@@ -489,15 +548,28 @@ IMessageScheduler * CSystemBoost::schedulerFactory()
 
 	int n = (boost::thread::hardware_concurrency() > 1) ? 2 : 1;
 
-	s.reset(new CBoostSchedulerMT(nodearch, io, n));
+	s.reset(new CBoostSchedulerMT(nodearch, io, n, getSchedulerOptions("factory")));
 
 	lock_guard<shared_mutex> lg(s_mutex);
+	s->setPrivateName((FMT("factory/%1%") % schedulers.size()).str());
 	schedulers.push_back(s);
 
 	return s.get();
 
 }
 
+/**
+ * @brief	Append all schedulers of the system
+ */
+void CSystemBoost::getSchedulers(std::list<IMessageScheduler *>& result)
+{
+	boost::shared_lock<shared_mutex> sl(s_mutex);
+	list<shared_ptr<IMessageScheduler> >::const_iterator it;
+
+	for (it = schedulers.begin(); it != schedulers.end(); it++)
+		result.push_back(it->get());
+}
+
 ISyncFactory * CSystemBoost::getSyncFactory()
 {
 	return this->syncFactory.get();
@@ -19,6 +19,7 @@
 #include "netAdaptBoostUDP.h"
 #include "socketAppConnector.h"
 #include "memAppConnector.h"
+#include "boostSchedulerMt.h"
 #include "sync.h"
 #include "debug.h"
 
@@ -122,6 +123,8 @@ public:
 private:
 	int port; 					///< default port for net Adapts
 	int nthreads;				///< number of threads to be used
+	CBoostSchedulerMT::Options schedulerOptions;	///< default options for all schedulers
+	std::vector<int> ioCpus;	///< CPUs of the i/o thread, empty for no pinning
 
 	boost::posix_time::ptime daemonStartTime;	///< time of daemon start
 
@@ -147,6 +150,9 @@ private:
 	/// runs io stuff
 	void io_run ();
 
+	/// returns the scheduler options for the given scheduler ("main" for the main scheduler)
+	CBoostSchedulerMT::Options getSchedulerOptions (const std::string & name);
+
 public:
 	CSystemBoost(IDebugChannel::VerbosityLevel vlevel);
 	CSystemBoost(IDebugChannel::VerbosityLevel vlevel, int nthreads);								///< Constructor
@@ -188,6 +194,11 @@ public:
 	 */
 	virtual IMessageScheduler *schedulerFactory();
 
+	/**
+	 * @brief	Append all schedulers of the system
+	 */
+	virtual void getSchedulers(std::list<IMessageScheduler *>& result);
+
 	virtual std::string getNodeName() const;				///< Return the current node's name
 	/**
 	 * Set the port for net Adapts
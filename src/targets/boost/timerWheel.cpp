@@ -0,0 +1,199 @@
+/** @file
+ * timerWheel.cpp
+ *
+ * @brief Hashed timing wheel for scheduler timers
+ *
+ * (c) 2008-2012 Institut fuer Telematik, KIT, Germany
+ */
+
+#include "timerWheel.h"
+
+#include "debug.h"
+
+#include <boost/bind.hpp>
+
+#include <algorithm>
+#include <exception>
+
+using boost::asio::deadline_timer;
+using boost::mutex;
+using boost::lock_guard;
+using boost::shared_ptr;
+
+using namespace std;
+
+CTimerWheel::CTimerWheel (shared_ptr<boost::asio::io_service> ios, ExpiryHandler handler, double tick, size_t slots) :
+	io_service(ios),
+	ticker(*ios),
+	handler(handler),
+	tickLength((int64_t) (tick * 1000000)),
+	start(deadline_timer::traits_type::now()),
+	wheel(slots > 0 ? slots : 1),
+	current(0),
+	ticking(false),
+	stopped(false)
+{
+	if (tickLength < 1)
+		tickLength = 1;
+
+	index.rehash(wheel.size());
+}
+
+CTimerWheel::~CTimerWheel ()
+{
+}
+
+uint64_t CTimerWheel::tickAt (const boost::posix_time::ptime & t) const
+{
+	if (t <= start)
+		return 0;
+
+	return (t - start).total_microseconds() / tickLength;
+}
+
+void CTimerWheel::armTicker ()
+{
+	ticker.expires_at(start + boost::posix_time::microseconds(tickLength * (int64_t) (current + 1)));
+	ticker.async_wait(boost::bind(&CTimerWheel::handle_tick, shared_from_this(), boost::asio::placeholders::error));
+	ticking = true;
+}
+
+void CTimerWheel::set (shared_ptr<CTimer> & timer)
+{
+	boost::posix_time::ptime now = deadline_timer::traits_type::now();
+	boost::posix_time::ptime due = now + boost::posix_time::microseconds((int64_t) (timer->timeout * 1000000));
+
+	lock_guard<mutex> lg(wheelMutex);
+	if (stopped)
+		return;
+
+	boost::unordered_map<CTimer *, CIndex>::iterator it = index.find(timer.get());
+	if (it != index.end()) {
+		wheel[it->second.slot].erase(it->second.it);
+		index.erase(it);
+	}
+
+	/// wheel was idle, skip the ticks we did not need to process
+	if (!ticking)
+		current = max(current, tickAt(now));
+
+	/// the tick after the one containing due, so we never fire early
+	uint64_t expiry = max(tickAt(due) + 1, current + 1);
+
+	CIndex i;
+	i.slot = expiry % wheel.size();
+	i.it = wheel[i.slot].insert(wheel[i.slot].end(), CEntry(timer, expiry));
+	index[timer.get()] = i;
+
+	if (!ticking)
+		armTicker();
+}
+
+bool CTimerWheel::cancel (shared_ptr<CTimer> & timer)
+{
+	lock_guard<mutex> lg(wheelMutex);
+
+	boost::unordered_map<CTimer *, CIndex>::iterator it = index.find(timer.get());
+	if (it == index.end())
+		return false;
+
+	// the ticker keeps running until the next tick finds the wheel empty
+	wheel[it->second.slot].erase(it->second.it);
+	index.erase(it);
+	return true;
+}
+
+void CTimerWheel::stop ()
+{
+	boost::unique_lock<mutex> lock(wheelMutex);
+
+	stopped = true;
+	if (ticking) {
+		boost::system::error_code ec;
+		ticker.cancel(ec);
+		ticking = false;
+	}
+
+	index.clear();
+	for (size_t i = 0; i < wheel.size(); i++)
+		wheel[i].clear();
+
+	/// a handler may stop the wheel itself, do not wait for our own thread
+	size_t self = count(dispatchers.begin(), dispatchers.end(), boost::this_thread::get_id());
+	while (dispatchers.size() > self)
+		dispatched.wait(lock);
+}
+
+size_t CTimerWheel::size ()
+{
+	lock_guard<mutex> lg(wheelMutex);
+	return index.size();
+}
+
+void CTimerWheel::handle_tick (const boost::system::error_code & error)
+{
+	if (error == boost::asio::error::operation_aborted)
+		return;
+
+	vector<shared_ptr<CTimer> > expired;
+
+	{
+		lock_guard<mutex> lg(wheelMutex);
+		ticking = false;
+
+		if (stopped)
+			return;
+
+		uint64_t now = max(tickAt(deadline_timer::traits_type::now()), current + 1);
+
+		/// catch up on all ticks since the last run, but visit each slot once
+		uint64_t n = min(now - current, (uint64_t) wheel.size());
+		for (uint64_t t = current + 1; t <= current + n; t++) {
+			Slot & slot = wheel[t % wheel.size()];
+			Slot::iterator it = slot.begin();
+			while (it != slot.end()) {
+				if (it->expiry <= now) {
+					expired.push_back(it->timer);
+					index.erase(it->timer.get());
+					it = slot.erase(it);
+
+				} else {
+					it++;
+
+				}
+			}
+		}
+		current = now;
+
+		if (!index.empty())
+			armTicker();
+
+		if (expired.empty())
+			return;
+
+		dispatchers.push_back(boost::this_thread::get_id());
+	}
+
+	for (vector<shared_ptr<CTimer> >::iterator it = expired.begin(); it != expired.end(); it++) {
+		{
+			lock_guard<mutex> lg(wheelMutex);
+			if (stopped)
+				break;
+		}
+
+		try {
+			handler(*it);
+
+		} catch (std::exception & e) {
+			DBG_WARNING(FMT("CTimerWheel: dropping expired timer: %1%") % e.what());
+
+		} catch (...) {
+			DBG_WARNING("CTimerWheel: dropping expired timer");
+
+		}
+	}
+
+	lock_guard<mutex> lg(wheelMutex);
+	dispatchers.erase(find(dispatchers.begin(), dispatchers.end(), boost::this_thread::get_id()));
+	dispatched.notify_all();
+}
@@ -0,0 +1,117 @@
+/** @file
+ * timerWheel.h
+ *
+ * @brief Hashed timing wheel for scheduler timers
+ *
+ * (c) 2008-2012 Institut fuer Telematik, KIT, Germany
+ */
+
+#ifndef TIMERWHEEL_H_
+#define TIMERWHEEL_H_
+
+#include "messages.h"
+
+#include <boost/asio.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/unordered_map.hpp>
+
+#include <list>
+#include <vector>
+
+#include <stdint.h>
+
+/**
+ * @brief	Hashed timing wheel driven by a single asio timer
+ *
+ * 			Timers are hashed into slots by their expiry tick, slots hold
+ * 			timers of all rounds (Varghese & Lauck, scheme 6). set() and
+ * 			cancel() are O(1); on each tick, all expired timers of a slot are
+ * 			collected under the lock and handed to the expiry handler
+ * 			afterwards. Timers never fire early; they fire at most one tick
+ * 			late. The asio timer only runs while timers are pending.
+ *
+ * 			Must be created via shared_ptr since pending asio handlers keep
+ * 			the wheel alive. Call stop() before the owner of the expiry
+ * 			handler goes away.
+ */
+class CTimerWheel : public boost::enable_shared_from_this<CTimerWheel>
+{
+public:
+	typedef boost::function<void (boost::shared_ptr<CTimer> &)> ExpiryHandler;
+
+	/**
+	 * @param ios		io_service running the tick timer
+	 * @param handler	called for every expired timer (from an io_service thread)
+	 * @param tick		tick length in seconds
+	 * @param slots		number of slots, should cover the common timeouts
+	 */
+	CTimerWheel (boost::shared_ptr<boost::asio::io_service> ios, ExpiryHandler handler,
+			double tick = 0.001, size_t slots = 1024);
+	virtual ~CTimerWheel ();
+
+	/// (re-)arm a timer, a pending timer is moved to its new expiry
+	void set (boost::shared_ptr<CTimer> & timer);
+
+	/// cancel a timer, returns false if it was not pending
+	bool cancel (boost::shared_ptr<CTimer> & timer);
+
+	/// drop all timers and stop ticking, waits for handler calls of other
+	/// threads in progress, no handler is called afterwards
+	void stop ();
+
+	/// number of pending timers
+	size_t size ();
+
+private:
+	class CEntry
+	{
+	public:
+		boost::shared_ptr<CTimer> timer;
+		uint64_t expiry;		///< absolute tick
+
+		CEntry (const boost::shared_ptr<CTimer> & timer, uint64_t expiry) :
+			timer(timer), expiry(expiry) {}
+	};
+
+	typedef std::list<CEntry> Slot;
+
+	/// position of a pending timer
+	class CIndex
+	{
+	public:
+		size_t slot;
+		Slot::iterator it;
+	};
+
+	boost::shared_ptr<boost::asio::io_service> io_service;
+	boost::asio::deadline_timer ticker;
+	ExpiryHandler handler;
+
+	int64_t tickLength;					///< in microseconds
+	boost::posix_time::ptime start;		///< time of tick 0
+
+	boost::mutex wheelMutex;			///< protects everything below
+	std::vector<Slot> wheel;
+	boost::unordered_map<CTimer *, CIndex> index;
+	uint64_t current;					///< last processed tick
+	bool ticking;						///< tick timer armed
+	bool stopped;
+	std::vector<boost::thread::id> dispatchers;	///< threads calling the handler
+	boost::condition_variable dispatched;		///< signalled when a thread is done calling the handler
+
+	/// tick containing the given time
+	uint64_t tickAt (const boost::posix_time::ptime & t) const;
+
+	/// arm the tick timer for the tick after current, needs the lock
+	void armTicker ();
+
+	void handle_tick (const boost::system::error_code & error);
+};
+
+#endif /* TIMERWHEEL_H_ */
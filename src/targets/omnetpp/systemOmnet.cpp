@@ -304,6 +304,11 @@ IMessageScheduler * CSystemOmnet::schedulerFactory ()
 	return this;
 }
 
+void CSystemOmnet::getSchedulers (std::list<IMessageScheduler *>& schedulers)
+{
+	schedulers.push_back(this);
+}
+
 void CSystemOmnet::initSchedulers (CNena * na)
 {
 	return;
@@ -162,6 +162,11 @@ protected:
 	 */
 	virtual IMessageScheduler *schedulerFactory ();
 
+	/**
+	 * @brief	Append all schedulers of the system
+	 */
+	virtual void getSchedulers (std::list<IMessageScheduler *>& schedulers);
+
 	virtual void initSchedulers (CNena * na);
 	virtual IMessageScheduler * lookupScheduler (IMessageProcessor * proc);
 